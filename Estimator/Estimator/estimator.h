@@ -116,6 +116,45 @@ namespace vrlt {
         ThreePointPose() { poses.push_back( Sophus::SE3d() ); }
     };
 
+    /** \brief Two point pose with known gravity
+     *
+     * Pose estimation from two points using a calibrated camera whose direction of gravity is known,
+     * e.g. from the device's accelerometer.  Only the heading and the translation are estimated, so
+     * two points suffice and far fewer samples are needed than with ThreePointPose.
+     */
+    struct TwoPointGravityPose : public Estimator
+    {
+        Eigen::Vector3d world_down;     ///< Direction of gravity in the world frame.
+        Eigen::Vector3d camera_down;    ///< Direction of gravity in the camera frame.
+        int sampleSize();
+        int compute( PointPairList::iterator begin, PointPairList::iterator end );
+        void chooseSolution( int soln );
+        double score( PointPairList::iterator it );
+        std::vector< Sophus::SE3d > poses;
+        Sophus::SE3d pose;
+        TwoPointGravityPose( const Eigen::Vector3d &_world_down, const Eigen::Vector3d &_camera_down )
+        : world_down( _world_down ), camera_down( _camera_down ) { poses.push_back( Sophus::SE3d() ); }
+    };
+
+    /** \brief Three point pose for a camera rig
+     *
+     * Pose estimation from three points observed by a rig of cameras which share an optical center,
+     * such as the faces extracted from a spherical or catadioptric image.  The observations are unit
+     * bearing vectors in the rig frame, so unlike ThreePointPose they may point in any direction, and
+     * the three points of a sample may come from different cameras.  The score is the squared tangent
+     * of the angle between the observed and predicted bearings.
+     */
+    struct RigThreePointPose : public Estimator
+    {
+        int sampleSize();
+        int compute( PointPairList::iterator begin, PointPairList::iterator end );
+        void chooseSolution( int soln );
+        double score( PointPairList::iterator it );
+        std::vector< Sophus::SE3d > poses;
+        Sophus::SE3d pose;
+        RigThreePointPose() { scoreType = Angle; poses.push_back( Sophus::SE3d() ); }
+    };
+
     /** \brief Six point pose
      *
      * Linear pose estimation from six points using a calibrated camera.
@@ -196,6 +235,8 @@ namespace vrlt {
         int num_trials;
         double inlier_threshold;
         int min_num_inliers;
+        double max_time;    ///< time limit in seconds for the sampling loop; zero means no limit
+        bool timed_out;     ///< set by compute() when sampling stopped at max_time
         
         PROSAC();
         int compute( PointPairList::iterator begin, PointPairList::iterator end, Estimator &estimator, std::vector<bool> &inliers );
@@ -9,20 +9,18 @@
  */
 
 #include <Estimator/estimator.h>
+#include <MultiView/parallel.h>
 
 #include "five_point_relative_pose.h"
 #include "perspective_three_point.h"
 
 #include <algorithm>
+#include <chrono>
 
 #ifdef USE_ACCELERATE
 #include <Accelerate/Accelerate.h>
 #endif
 
-#ifdef USE_DISPATCH
-#include <dispatch/dispatch.h>
-#endif
-
 #include <iostream>
 
 namespace vrlt {
@@ -720,6 +718,154 @@ namespace vrlt {
         return false;
     }
     
+    int TwoPointGravityPose::sampleSize()
+    {
+        return 2;
+    }
+    
+    int TwoPointGravityPose::compute( PointPairList::iterator begin, PointPairList::iterator end )
+    {
+        poses.clear();
+        
+        // rotate both frames so that gravity is along y; the remaining rotation is then about y
+        Sophus::SO3d Qw( Eigen::Quaterniond::FromTwoVectors( world_down, Eigen::Vector3d::UnitY() ) );
+        Sophus::SO3d Qc( Eigen::Quaterniond::FromTwoVectors( camera_down, Eigen::Vector3d::UnitY() ) );
+        
+        // x cross ( Ry(theta) X + t ) = 0 gives two equations per point,
+        // linear in c = cos(theta), s = sin(theta) and t
+        Eigen::Matrix<double,4,2> Acs;
+        Eigen::Matrix<double,4,3> At;
+        Eigen::Vector4d b;
+        int n = 0;
+        PointPairList::iterator it;
+        for ( it = begin; n < 4; it++ )
+        {
+            Eigen::Vector3d X = Qw * it->first;
+            Eigen::Vector3d x = Qc * it->second;
+            
+            Acs.row(n) << x[0]*X[2] - x[2]*X[0], -x[0]*X[0] - x[2]*X[2];
+            At.row(n) << -x[2], 0, x[0];
+            b[n++] = 0;
+            
+            Acs.row(n) << x[1]*X[2], -x[1]*X[0];
+            At.row(n) << 0, -x[2], x[1];
+            b[n++] = x[2]*X[1];
+        }
+        
+        // eliminate t with the left null vector of At, leaving alpha c + beta s = gamma
+        Eigen::JacobiSVD< Eigen::Matrix<double,4,3> > svdAt( At, Eigen::ComputeFullU );
+        Eigen::Vector4d nullvec = svdAt.matrixU().col( 3 );
+        double alpha = nullvec.dot( Acs.col(0) );
+        double beta = nullvec.dot( Acs.col(1) );
+        double gamma = nullvec.dot( b );
+        
+        // intersect with the unit circle c^2 + s^2 = 1
+        double normsq = alpha*alpha + beta*beta;
+        if ( normsq < 1e-12 ) return 0;
+        double discriminant = normsq - gamma*gamma;
+        if ( discriminant < 0 ) return 0;
+        double root = sqrt( discriminant );
+        
+        int nroots = ( root > 0 ) ? 2 : 1;
+        for ( int i = 0; i < nroots; i++ )
+        {
+            double sign = ( i == 0 ) ? 1. : -1.;
+            double c = ( alpha * gamma - sign * beta * root ) / normsq;
+            double s = ( beta * gamma + sign * alpha * root ) / normsq;
+            
+            Eigen::Vector3d t = At.jacobiSvd( Eigen::ComputeFullU | Eigen::ComputeFullV ).solve( b - Acs * Eigen::Vector2d( c, s ) );
+            
+            Eigen::Matrix3d Ry;
+            Ry <<
+            c, 0, s,
+            0, 1, 0,
+            -s, 0, c;
+            
+            Sophus::SE3d rotated_pose( Sophus::SO3d( Ry ), t );
+            poses.push_back( Sophus::SE3d( Qc.inverse(), Eigen::Vector3d::Zero() ) * rotated_pose * Sophus::SE3d( Qw, Eigen::Vector3d::Zero() ) );
+        }
+        
+        return poses.size();
+    }
+    
+    void TwoPointGravityPose::chooseSolution( int soln )
+    {
+        pose = poses[soln];
+    }
+    
+    double TwoPointGravityPose::score( PointPairList::iterator it )
+    {
+        Eigen::Vector3d poseX = pose * it->first;
+        if ( poseX.dot( it->second ) < 0 ) return INFINITY;
+        
+        Eigen::Vector2d diff = project( poseX ) - project( it->second );
+        return diff.dot(diff);
+    }
+    
+    int RigThreePointPose::sampleSize()
+    {
+        return 3;
+    }
+    
+    int RigThreePointPose::compute( PointPairList::iterator begin, PointPairList::iterator end )
+    {
+        Eigen::Vector3d bearings[3];
+        Eigen::Vector3d world_point[3];
+        
+        int n = 0;
+        PointPairList::iterator it;
+        for ( it = begin; n < 3; it++,n++ ) {
+            world_point[n] = it->first;
+            bearings[n] = it->second.normalized();
+        }
+        
+        poses.clear();
+        
+        // rotate the bearings into a virtual camera looking along their mean, so that
+        // the perspective solver can be used for bearings from any camera of the rig
+        Eigen::Vector3d mean = bearings[0] + bearings[1] + bearings[2];
+        if ( mean.norm() < 1e-6 ) return 0;
+        mean.normalize();
+        Sophus::SO3d virtual_rotation( Eigen::Quaterniond::FromTwoVectors( mean, Eigen::Vector3d::UnitZ() ) );
+        
+        Eigen::Vector2d feature_point[3];
+        for ( n = 0; n < 3; n++ ) {
+            Eigen::Vector3d bearing = virtual_rotation * bearings[n];
+            if ( bearing[2] < 1e-3 ) return 0;
+            feature_point[n] = project( bearing );
+        }
+        
+        std::vector<Eigen::Matrix3d> solution_rotations;
+        std::vector<Eigen::Vector3d> solution_translations;
+        theia::PoseFromThreePoints( feature_point, world_point, &solution_rotations, &solution_translations );
+        poses.resize( solution_rotations.size() );
+        for ( size_t i = 0; i < solution_rotations.size(); i++ )
+        {
+            Sophus::SE3d virtual_pose;
+            virtual_pose.so3() = Sophus::SO3d( solution_rotations[i] );
+            virtual_pose.translation() = solution_translations[i];
+            poses[i] = Sophus::SE3d( virtual_rotation.inverse(), Eigen::Vector3d::Zero() ) * virtual_pose;
+        }
+        
+        return poses.size();
+    }
+    
+    void RigThreePointPose::chooseSolution( int soln )
+    {
+        pose = poses[soln];
+    }
+    
+    double RigThreePointPose::score( PointPairList::iterator it )
+    {
+        Eigen::Vector3d poseX = pose * it->first;
+        
+        double c = poseX.dot( it->second );
+        if ( c <= 0 ) return INFINITY;
+        
+        double s = poseX.cross( it->second ).norm();
+        return ( s * s ) / ( c * c );
+    }
+    
     /*
     int Homography::sampleSize()
     {
@@ -830,40 +976,52 @@ namespace vrlt {
     PROSAC::PROSAC() :
     num_trials( 20000 ),
     inlier_threshold( 0.01 ),
-    min_num_inliers( 100 )
+    min_num_inliers( 100 ),
+    max_time( 0 ),
+    timed_out( false )
     {
         
     }
     
+    static double secondsSince( const std::chrono::steady_clock::time_point &start )
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    }
+    
+    // inliers are scored in chunks of this many, and short lists on the calling thread only
+    static const size_t kInlierGrain = 256;
+    
     struct InlierData
     {
         double threshsq;
         PointPairList::iterator begin;
         Estimator &estimator;
-        std::vector<bool> &inliers;
-        InlierData( double _threshsq, PointPairList::iterator _begin, Estimator &_estimator, std::vector<bool> &_inliers )
-        : threshsq( _threshsq ), begin( _begin ), estimator( _estimator ), inliers( _inliers ) { }
+        std::vector<char> good;     // not a vector<bool>, whose bits cannot be written from several threads
+        InlierData( double _threshsq, PointPairList::iterator _begin, Estimator &_estimator )
+        : threshsq( _threshsq ), begin( _begin ), estimator( _estimator ) { }
     };
 
     static void inlierFn( void *context, size_t n )
     {
         InlierData *inlierData = (InlierData*)context;
-        inlierData->inliers[n] = ( inlierData->estimator.score( inlierData->begin+n ) < inlierData->threshsq );
+        inlierData->good[n] = ( inlierData->estimator.score( inlierData->begin+n ) < inlierData->threshsq );
+    }
+    
+    static void findInliers( double threshsq, PointPairList::iterator begin, int N, Estimator &estimator, std::vector<bool> &inliers )
+    {
+        InlierData inlierData( threshsq, begin, estimator );
+        inlierData.good.resize( N );
+        parallel_for( N, &inlierData, inlierFn, kInlierGrain );
+        inliers.resize( N );
+        for ( int n = 0; n < N; n++ ) inliers[n] = inlierData.good[n];
     }
     
     int PROSAC::countInliers( PointPairList::iterator begin, PointPairList::iterator end, Estimator &estimator )
     {
         int N = (int) distance( begin, end );
         double threshsq = inlier_threshold * inlier_threshold;
-        std::vector<bool> inliers( N );
-        PointPairList::iterator it;
-        InlierData inlierData( threshsq, begin, estimator, inliers );
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( N, queue, &inlierData, inlierFn );
-#else
-        for ( int i = 0; i < N; i++ ) inlierFn( &inlierData, i );
-#endif
+        std::vector<bool> inliers;
+        findInliers( threshsq, begin, N, estimator, inliers );
         int count = 0;
         for ( int n = 0; n < N; n++ )
         {
@@ -876,15 +1034,7 @@ namespace vrlt {
     {
         int N = (int) distance( begin, end );
         double threshsq = inlier_threshold * inlier_threshold;
-        inliers.resize( N );
-        PointPairList::iterator it;
-        InlierData inlierData( threshsq, begin, estimator, inliers );
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( N, queue, &inlierData, inlierFn );
-#else
-        for ( int i = 0; i < N; i++ ) inlierFn( &inlierData, i );
-#endif
+        findInliers( threshsq, begin, N, estimator, inliers );
 //        int n = 0;
 //        int count = 0;
 //        for ( it = begin; it != end; it++,n++ ) {
@@ -904,15 +1054,7 @@ namespace vrlt {
     {
         int N = (int) distance( begin, end );
         double threshsq = inlier_threshold * inlier_threshold;
-        inliers.resize( N );
-        PointPairList::iterator it;
-        InlierData inlierData( threshsq, begin, estimator, inliers );
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( N, queue, &inlierData, inlierFn );
-#else
-        for ( int i = 0; i < N; i++ ) inlierFn( &inlierData, i );
-#endif
+        findInliers( threshsq, begin, N, estimator, inliers );
         //        int n = 0;
         //        int count = 0;
         //        for ( it = begin; it != end; it++,n++ ) {
@@ -984,6 +1126,9 @@ namespace vrlt {
         unsigned T_n_prime = 1;
         unsigned max_K = 0;
         
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        timed_out = false;
+        
         if ( N < estimator.sampleSize() )
         {
             inliers.resize(N);
@@ -1028,6 +1173,18 @@ namespace vrlt {
                 }
             }
             if ( bestNInliers >= Kthresh ) break;
+            
+            // out of time: settle for the best hypothesis so far
+            if ( max_time > 0 && secondsSince( start ) > max_time ) {
+                timed_out = true;
+                break;
+            }
+        }
+        
+        if ( max_K == 0 )
+        {
+            inliers.assign( N, false );
+            return 0;
         }
         
         int nsolns = estimator.compute( best_subset.begin(), best_subset.end() );
@@ -1077,6 +1234,9 @@ namespace vrlt {
         unsigned T_n_prime = 1;
         unsigned max_K = 0;
         
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        timed_out = false;
+        
         if ( N < estimator.sampleSize() )
         {
             inliers.resize(N);
@@ -1122,6 +1282,18 @@ namespace vrlt {
                 }
             }
             if ( bestNInliers >= Kthresh ) break;
+            
+            // out of time: settle for the best hypothesis so far
+            if ( max_time > 0 && secondsSince( start ) > max_time ) {
+                timed_out = true;
+                break;
+            }
+        }
+        
+        if ( max_K == 0 )
+        {
+            inliers.assign( distance( all_begin, all_end ), false );
+            return 0;
         }
         
         int nsolns = estimator.compute( best_subset.begin(), best_subset.end() );
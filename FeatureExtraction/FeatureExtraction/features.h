@@ -13,6 +13,8 @@
 
 #include <MultiView/multiview.h>
 
+#include <opencv2/features2d.hpp>
+
 namespace vrlt {
 
 /** \addtogroup FeatureExtraction
@@ -32,6 +34,53 @@ namespace vrlt {
      * \param[in] contrast_thresh     Contrast threshold for SIFT feature detector, defaults to 0.04
      */
     int extractSIFT( cv::Mat &image, std::vector<Feature*> &features, int o_min = 0, double contrast_thresh = 0.04 );
+
+    /**
+     * \brief Reusable storage for features extracted from successive frames.
+     *
+     * Features handed out by the store are owned by it and stay allocated, along with their descriptors and
+     * the detector's scratch buffers, when the store is reset.  After the first few frames, extraction into
+     * a store does not allocate any features.
+     */
+    class FeatureStore
+    {
+    public:
+        FeatureStore();
+        ~FeatureStore();
+        
+        /** \brief Returns all features to the store.  Features from the previous frame must no longer be used. */
+        void reset();
+        
+        /** \brief Returns an unused feature with a 128-byte descriptor and a unique name. */
+        Feature * get();
+        
+        /** \brief Number of features handed out since the last reset. */
+        size_t size() const { return nused; }
+        
+        // detector state reused between frames
+        cv::Ptr<cv::Feature2D> sift;
+        double sift_contrast_thresh;
+        cv::Mat gray_image;
+        std::vector<cv::KeyPoint> keypoints;
+        cv::Mat descriptors;
+        
+    protected:
+        std::vector<Feature*> pool;
+        size_t nused;
+    };
+    
+    /**
+     * \brief Extract SIFT features from an image into a feature store.
+     *
+     * The store is reset first, so features previously taken from it are invalidated.
+     *
+     * \param[in] image               The image from which features will be extracted
+     * \param[in,out] store           Storage for the features
+     * \param[out] features           Vector of feature structures, owned by the store
+     * \param[in] o_min               Minimum octave at which features will be extracted, defaults to 0
+     * \param[in] contrast_thresh     Contrast threshold for SIFT feature detector, defaults to 0.04
+     */
+    int extractSIFT( cv::Mat &image, FeatureStore &store, std::vector<Feature*> &features, int o_min = 0, double contrast_thresh = 0.04 );
 /**
  * @}
  */
@@ -18,6 +18,7 @@
 #include <opencv2/xfeatures2d.hpp>
 
 #include <iostream>
+#include <sstream>
 
 namespace vrlt {
     
@@ -29,6 +30,37 @@ namespace vrlt {
         for ( int i = 0; i < 128; i++ ) floatdata[i] /= norm;
     }
     
+    static void fillFeature( Feature *feature, cv::Mat &image, const cv::KeyPoint &keypoint, float *floatdata )
+    {
+        feature->location[0] = keypoint.pt.x;
+        feature->location[1] = keypoint.pt.y;
+        feature->scale = keypoint.size;
+        feature->orientation = keypoint.angle;
+        
+        if ( image.channels() == 3 )
+        {
+            cv::Vec3b color = getColorSubpix( image, keypoint.pt );
+            feature->color[0] = color[0];
+            feature->color[1] = color[1];
+            feature->color[2] = color[2];
+        }
+        else
+        {
+            uchar gray = getGraySubpix( image, keypoint.pt );
+            feature->color[0] = gray;
+            feature->color[1] = gray;
+            feature->color[2] = gray;
+        }
+        
+        normalizeFloats( floatdata );
+        
+        for ( int k = 0; k < 128; k++ ) {
+            float val = floatdata[k] * 512.f;
+            if ( val > 255.f ) val = 255.f;
+            feature->descriptor[k] = (unsigned char) val;
+        }
+    }
+    
     int extractSIFT( cv::Mat &image, std::vector<Feature*> &features, int o_min, double contrast_thresh )
     {
         cv::Mat gray_image;
@@ -60,34 +92,78 @@ namespace vrlt {
             if ( (keypoints[i].octave & 255) < o_min ) continue;
             
             Feature *feature = new Feature;
-            feature->location[0] = keypoints[i].pt.x;
-            feature->location[1] = keypoints[i].pt.y;
-            feature->scale = keypoints[i].size;
-            feature->orientation = keypoints[i].angle;
-            
-            if ( image.channels() == 3 )
-            {
-                cv::Vec3b color = getColorSubpix( image, keypoints[i].pt );
-                feature->color[0] = color[0];
-                feature->color[1] = color[1];
-                feature->color[2] = color[2];
-            }
-            else
-            {
-                uchar gray = getGraySubpix( image, keypoints[i].pt );
-                feature->color[0] = gray;
-                feature->color[1] = gray;
-                feature->color[2] = gray;
-            }
-            
-            normalizeFloats( floatdata );
-
             feature->descriptor = new unsigned char[128];
-            for ( int k = 0; k < 128; k++ ) {
-                float val = floatdata[k] * 512.f;
-                if ( val > 255.f ) val = 255.f;
-                feature->descriptor[k] = (unsigned char) val;
-            }
+            fillFeature( feature, image, keypoints[i], floatdata );
+            features.push_back( feature );
+        }
+        
+        return features.size();
+    }
+    
+    FeatureStore::FeatureStore() : sift_contrast_thresh( 0 ), nused( 0 )
+    {
+        
+    }
+    
+    FeatureStore::~FeatureStore()
+    {
+        for ( size_t i = 0; i < pool.size(); i++ ) delete pool[i];
+    }
+    
+    void FeatureStore::reset()
+    {
+        nused = 0;
+    }
+    
+    Feature * FeatureStore::get()
+    {
+        if ( nused == pool.size() )
+        {
+            Feature *feature = new Feature;
+            feature->descriptor = new unsigned char[128];
+            std::stringstream name;
+            name << "feature" << pool.size();
+            feature->name = name.str();
+            pool.push_back( feature );
+        }
+        
+        Feature *feature = pool[nused++];
+        feature->track = NULL;
+        feature->camera = NULL;
+        feature->matches.clear();
+        return feature;
+    }
+    
+    int extractSIFT( cv::Mat &image, FeatureStore &store, std::vector<Feature*> &features, int o_min, double contrast_thresh )
+    {
+        store.reset();
+        
+        cv::Mat *gray_image = &image;
+        if ( image.channels() == 3 )
+        {
+            cv::cvtColor( image, store.gray_image, cv::COLOR_RGB2GRAY );
+            gray_image = &store.gray_image;
+        }
+        
+        // the detector keeps its settings, so it only needs to be recreated when they change
+        if ( store.sift.empty() || store.sift_contrast_thresh != contrast_thresh )
+        {
+            store.sift = cv::xfeatures2d::SIFT::create( 0, 3, contrast_thresh );
+            store.sift_contrast_thresh = contrast_thresh;
+        }
+        store.sift->detect( *gray_image, store.keypoints );
+        store.sift->compute( *gray_image, store.keypoints, store.descriptors );
+        
+        float *floatdata = (float*)store.descriptors.ptr();
+        
+        features.clear();
+        features.reserve( store.keypoints.size() );
+        for ( size_t i = 0; i < store.keypoints.size(); i++,floatdata+=128 )
+        {
+            if ( (store.keypoints[i].octave & 255) < o_min ) continue;
+            
+            Feature *feature = store.get();
+            fillFeature( feature, image, store.keypoints[i], floatdata );
             features.push_back( feature );
         }
         
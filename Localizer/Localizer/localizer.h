@@ -28,9 +28,33 @@ namespace vrlt
         Localizer( Node *_root, Node *_tracker_root = NULL );
         virtual ~Localizer();
         
+        /** \brief Quality of the pose returned by the last call to localize(). */
+        enum Quality
+        {
+            Failed,     ///< No pose was found.
+            Coarse,     ///< Pose from robust estimation only; refinement was skipped to meet the time budget.
+            Partial,    ///< Matching, estimation or refinement was cut short to meet the time budget.
+            Refined     ///< Refinement converged or ran all of its rounds.
+        };
+        
         double thresh;
         double min_tracker_ratio;
         bool verbose;
+        double time_budget;     ///< Time allowed for one call to localize() in seconds, or zero for no limit.
+        bool adaptive_refinement;   ///< Search only the tracker levels the pose error calls for, and stop refining once the pose settles.
+        bool has_gravity;           ///< Whether the direction of gravity is known for the next query, e.g. from the device attitude.
+        Eigen::Vector3d gravity;    ///< Direction of gravity in the query camera frame, used if has_gravity is set.
+        Eigen::Vector3d map_down;   ///< Direction of gravity in the map frame; +y for upright or geo-registered maps.
+        Quality quality;
+        
+        // statistics of the pose returned by the last call to localize()
+        int ninliers;                               ///< Inliers supporting the pose.
+        double rms;                                 ///< RMS reprojection error of the inliers in pixels, or zero if unknown.
+        Eigen::Matrix<double,6,6> covariance;       ///< Covariance of the update exp(d)*pose, or zero if unknown.
+        double match_time;                          ///< Seconds spent matching features.
+        double estimation_time;                     ///< Seconds spent in robust pose estimation.
+        double refinement_time;                     ///< Seconds spent in tracking and refinement.
+        
         virtual bool localize( Camera *querycamera );
         
 //        bool refinePose( Camera *camera_in, float lambda );
@@ -14,6 +14,8 @@
 #include <Localizer/localizer.h>
 #include <FeatureMatcher/featurematcher.h>
 
+#include <chrono>
+
 namespace vrlt
 {
 
@@ -28,12 +30,45 @@ namespace vrlt
         ~NNLocalizer();
         
         bool localize( Camera *querycamera );
+        
+        /**
+         * \brief Localizes a camera rig, such as the faces extracted from a spherical or catadioptric image.
+         *
+         * The cameras of the rig are attached to rignode or its descendants, posed relative to rignode, and must share
+         * an optical center.  Features from all cameras are matched in one batch and the pose of rignode is estimated
+         * jointly from all of them.  Unlike localize(), the pose is refined on the feature matches rather than with the
+         * patch tracker.
+         *
+         * \return True if the rig was localized, in which case rignode->pose is set.
+         */
+        bool localizeRig( Node *rignode );
+        
+        /**
+         * \brief Localizes a query from a prior pose, such as that of a near-identical earlier query, without matching features.
+         *
+         * The prior is refined with the patch tracker as in the last stage of localize().
+         *
+         * \return True if tracking succeeded, in which case querycamera->node->pose is set.
+         */
+        bool localizeFrom( Camera *querycamera, const Sophus::SE3d &prior );
     protected:
+        /**
+         * Refines querycamera->node->pose with the patch tracker, within the time budget counted from start.
+         * expected_error bounds the error of the initial pose in pixels, or is zero if unknown.
+         */
+        bool refine( Camera *querycamera, const std::chrono::steady_clock::time_point &start, double expected_error,
+                     bool &truncated, bool &converged, bool &skipped );
+        
+        /** Matches the features of the cameras under querynode, capping their number under a time budget. */
+        bool matchFeatures( Node *querynode, const std::chrono::steady_clock::time_point &start, std::vector<Match*> &matches, bool &truncated );
+        
         FeatureMatcher *fm;
         std::vector<Feature*> features;
         
         size_t N;
         
+        double match_time_per_feature;  // running estimate used to cap the query size under a time budget
+        
         friend void doFindMatches( void *context, size_t i );
     }; 
 /**
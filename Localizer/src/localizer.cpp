@@ -16,7 +16,9 @@
 namespace vrlt
 {
     Localizer::Localizer( Node *_root, Node *_tracker_root )
-    : verbose( false ), root( _root )
+    : verbose( false ), time_budget( 0 ), adaptive_refinement( false ), has_gravity( false ), gravity( Eigen::Vector3d::UnitY() ), map_down( Eigen::Vector3d::UnitY() ), quality( Failed ),
+      ninliers( 0 ), rms( 0 ), covariance( Eigen::Matrix<double,6,6>::Zero() ),
+      match_time( 0 ), estimation_time( 0 ), refinement_time( 0 ), root( _root )
     {
         if ( _tracker_root == NULL ) _tracker_root = root->root();
         tracker = new Tracker( _tracker_root, 4096 );//1024 );
@@ -35,6 +37,10 @@ namespace vrlt
     
     bool Localizer::localize( Camera *querycamera )
     {
+        quality = Failed;
+        ninliers = 0;
+        rms = 0;
+        covariance.setZero();
         return false;
         
     }
@@ -12,15 +12,18 @@
 #include <Estimator/estimator.h>
 #include <PatchTracker/tracker.h>
 #include <PatchTracker/robustlsq.h>
+#include <PatchTracker/patch.h>
 #include <BundleAdjustment/updatepose.h>
 
 #include <opencv2/imgproc.hpp>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 namespace vrlt
 {
-    NNLocalizer::NNLocalizer( Node *_root, NN *index ) : Localizer( _root )
+    NNLocalizer::NNLocalizer( Node *_root, NN *index ) : Localizer( _root ), match_time_per_feature( 0 )
     {
         fm = new FeatureMatcher( index );
         std::cout << "making averaged descriptors\n";
@@ -88,20 +91,110 @@ namespace vrlt
         bool operator()( Match *a, Match *b ) { return ( a->feature1->name > b->feature1->name ); }
     };
     
-    bool NNLocalizer::localize( Camera *querycamera )
+    struct SortByScale
+    {
+        bool operator()( Feature *a, Feature *b ) { return ( a->scale > b->scale ); }
+    };
+    
+    // fractions of the time budget by which matching and pose estimation should be finished
+    static const double kMatchingDeadline = 0.5;
+    static const double kEstimationDeadline = 0.7;
+    
+    static double secondsSince( const std::chrono::steady_clock::time_point &start )
+    {
+        return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    }
+    
+    // the NCC search covers this many pixels either way at each pyramid level
+    static const double kSearchRadius = 4.;
+    // adaptive refinement stops once a round moves the points less than this many pixels...
+    static const double kConvergedShift = 0.1;
+    // ...or less than this many while the inliers grow by under one percent
+    static const double kSettledShift = 0.5;
+    // and re-checks only the points already visible while the pose moves less than this
+    static const double kReuseVisibleShift = 4.;
+    
+    /** Returns the finest pyramid level between lastlevel and maxlevel whose search radius covers the given error in pixels. */
+    static int searchLevel( double error, int lastlevel, int maxlevel )
+    {
+        int level = lastlevel;
+        while ( level < maxlevel && kSearchRadius * ( 1 << level ) < error ) level++;
+        return level;
+    }
+    
+    /** Returns the largest image motion in pixels of the points tracked in the last round when the pose is updated. */
+    static double maxShift( Tracker *tracker, const Sophus::SE3d &update, double focal )
+    {
+        Eigen::Matrix3f R = update.so3().matrix().cast<float>();
+        Eigen::Vector3f t = update.translation().cast<float>();
+        
+        float shift = 0;
+        for ( int i = 0; i < tracker->nattempted; i++ )
+        {
+            Patch *patch = tracker->searchPatches[i];
+            if ( !patch->point->tracked ) continue;
+            
+            // PX is the point in the camera frame of the pose the round started from
+            Eigen::Vector3f PX = R * patch->PX + t;
+            if ( PX[2] <= 0 ) continue;
+            Eigen::Vector2f diff = PX.head(2) / PX[2] - patch->PX.head(2) / patch->PX[2];
+            shift = std::max( shift, diff.norm() );
+        }
+        
+        return shift * focal;
+    }
+    
+    bool NNLocalizer::matchFeatures( Node *querynode, const std::chrono::steady_clock::time_point &start, std::vector<Match*> &matches, bool &truncated )
     {
         features.clear();
-        addFeatures( querycamera->node, false, features );
+        addFeatures( querynode, false, features );
         if ( features.empty() ) return false;
         
-        std::vector<Match*> matches;
+        // under a time budget, match only as many features as we expect to finish in time,
+        // keeping the largest-scale ones since they are the most repeatable
+        if ( time_budget > 0 && match_time_per_feature > 0 )
+        {
+            double remaining = kMatchingDeadline * time_budget - secondsSince( start );
+            size_t max_features = ( remaining > 0 ) ? (size_t)( remaining / match_time_per_feature ) : 0;
+            if ( max_features < 100 ) max_features = 100;
+            if ( features.size() > max_features )
+            {
+                std::nth_element( features.begin(), features.begin() + max_features, features.end(), SortByScale() );
+                features.resize( max_features );
+                truncated = true;
+            }
+        }
         
         std::cout << "running query with " << features.size() << " features\n";
         
+        std::chrono::steady_clock::time_point match_start = std::chrono::steady_clock::now();
+        
         //findMatches( (*fm), features, matches );
         findUniqueMatches( (*fm), features, 0.8, matches );
-
+        
+        match_time = secondsSince( match_start );
+        double time_per_feature = match_time / features.size();
+        if ( match_time_per_feature == 0 ) match_time_per_feature = time_per_feature;
+        else match_time_per_feature = 0.8 * match_time_per_feature + 0.2 * time_per_feature;
+        
         std::cout << "done matching\n";
+        
+        return true;
+    }
+    
+    bool NNLocalizer::localize( Camera *querycamera )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool have_budget = ( time_budget > 0 );
+        bool truncated = false;
+        quality = Failed;
+        ninliers = 0;
+        rms = 0;
+        covariance.setZero();
+        match_time = estimation_time = refinement_time = 0;
+        
+        std::vector<Match*> matches;
+        if ( !matchFeatures( querycamera->node, start, matches, truncated ) ) return false;
 
         std::vector<bool> inliers;
         
@@ -124,15 +217,30 @@ namespace vrlt
         
         
         Sophus::SE3d best_pose;
-        int ninliers;
         
-        ThreePointPose estimator;
+        std::chrono::steady_clock::time_point estimation_start = std::chrono::steady_clock::now();
+        
+        ThreePointPose three_point;
+        TwoPointGravityPose two_point( map_down, gravity );
+        Estimator *estimator = &three_point;
         PROSAC prosac;
         prosac.num_trials = 5000;
+        if ( has_gravity ) {
+            // a two point sample is all inliers about 1/w times as often as a three point sample, for inlier ratio w,
+            // so far fewer trials reach the same confidence
+            estimator = &two_point;
+            prosac.num_trials = 1000;
+        }
         prosac.min_num_inliers = 100;
         prosac.inlier_threshold = thresh;
-        ninliers = prosac.compute( point_pairs.begin(), point_pairs.end(), estimator, inliers );
-        best_pose = estimator.pose;
+        if ( have_budget ) {
+            prosac.max_time = kEstimationDeadline * time_budget - secondsSince( start );
+            if ( prosac.max_time < 1e-3 ) prosac.max_time = 1e-3;
+        }
+        ninliers = prosac.compute( point_pairs.begin(), point_pairs.end(), *estimator, inliers );
+        best_pose = ( has_gravity ) ? two_point.pose : three_point.pose;
+        if ( prosac.timed_out ) truncated = true;
+        estimation_time = secondsSince( estimation_start );
         
 //        std::vector<Estimator*> estimators( 5000 );
 //        for ( size_t i = 0; i < estimators.size(); i++ ) estimators[i] = new ThreePointPose;
@@ -169,24 +277,339 @@ namespace vrlt
                 delete matches[i];
         }
         
-        RobustLeastSq robustlsq( root );
+        // the tracker only has to search as far as the inliers are off
+        double max_residual = 0;
+        for ( int i = 0; i < inliers.size(); i++ )
+        {
+            if ( !inliers[i] ) continue;
+            Eigen::Vector3d PX = best_pose * point_pairs[i].first;
+            if ( PX[2] <= 0 ) continue;
+            max_residual = std::max( max_residual, ( project( PX ) - project( point_pairs[i].second ) ).norm() );
+        }
+        max_residual *= querycamera->calibration->focal;
+        
         querycamera->node->pose = best_pose;
+        bool converged = false;
+        bool skipped_refinement = false;
+        bool good = refine( querycamera, start, max_residual, truncated, converged, skipped_refinement );
+        
+        if ( skipped_refinement && ninliers >= prosac.min_num_inliers )
+        {
+            // ran out of time before refinement; fall back to the PROSAC pose
+            querycamera->node->pose = best_pose;
+            good = true;
+            quality = Coarse;
+        }
+        else if ( good )
+        {
+            quality = ( truncated && !converged ) ? Partial : Refined;
+        }
+        
+        if ( verbose && have_budget ) std::cout << "localization took " << secondsSince( start ) << " s of " << time_budget << " s budget\n";
+
+        return good;
+    }
+    
+    bool NNLocalizer::refine( Camera *querycamera, const std::chrono::steady_clock::time_point &start, double expected_error,
+                              bool &truncated, bool &converged, bool &skipped )
+    {
+        bool have_budget = ( time_budget > 0 );
+        std::chrono::steady_clock::time_point refinement_start = std::chrono::steady_clock::now();
+        
+        int firstlevel = tracker->firstlevel;
+        int lastlevel = tracker->lastlevel;
+        if ( adaptive_refinement && expected_error > 0 ) tracker->firstlevel = searchLevel( expected_error, lastlevel, firstlevel );
+        int last_ninliers = 0;
+        
+        RobustLeastSq robustlsq( root );
         bool good = false;
+        converged = false;
+        skipped = false;
+        double round_time = 0;
         for ( int i = 0; i < 10; i++ )
         {
+            // stop refining if another round would not finish before the deadline
+            if ( have_budget && secondsSince( start ) + round_time > time_budget ) {
+                truncated = true;
+                skipped = ( i == 0 );
+                break;
+            }
+            
+            std::chrono::steady_clock::time_point round_start = std::chrono::steady_clock::now();
             Sophus::SE3d last_pose = querycamera->node->pose;
             tracker->verbose = false;
             good = tracker->track( querycamera );
             std::cout << "tracker tracked " << tracker->ntracked << " / " << tracker->nattempted << "\n";
             if ( !good ) break;
             if ( good ) {
-                robustlsq.run( querycamera );
+                {
+                    Profiler::Scope scope( tracker->profiler, "pose update", -1, tracker->ntracked );
+                    
+                    // the tracker's point store holds exactly the points it tracked, unless it tracks another map
+                    if ( tracker->root == root ) robustlsq.run( querycamera, tracker->pointStore );
+                    else robustlsq.run( querycamera );
+                }
 //                updatePose( root, querycamera );
                 Sophus::SE3d update = querycamera->node->pose * last_pose.inverse();
-                if ( update.log().norm() < 1e-6 ) break;
+                round_time = secondsSince( round_start );
+                if ( update.log().norm() < 1e-6 ) {
+                    converged = true;
+                    break;
+                }
+                
+                if ( adaptive_refinement )
+                {
+                    double shift = maxShift( tracker, update, querycamera->calibration->focal );
+                    bool settled = ( robustlsq.ninliers <= 1.01 * last_ninliers );
+                    if ( shift < kConvergedShift || ( settled && shift < kSettledShift ) ) {
+                        converged = true;
+                        break;
+                    }
+                    last_ninliers = robustlsq.ninliers;
+                    
+                    // the next round only has to search as far as this one moved the points
+                    tracker->firstlevel = searchLevel( 2. * shift, lastlevel, firstlevel );
+                    tracker->reuse_visible = ( shift < kReuseVisibleShift );
+                }
             }
         }
-
+        
+        tracker->firstlevel = firstlevel;
+        tracker->reuse_visible = false;
+        
+        refinement_time = secondsSince( refinement_start );
+        
+        if ( good )
+        {
+            ninliers = robustlsq.ninliers;
+            rms = robustlsq.rms;
+            covariance = robustlsq.covariance;
+        }
+        
+        return good;
+    }
+    
+    bool NNLocalizer::localizeFrom( Camera *querycamera, const Sophus::SE3d &prior )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool truncated = false;
+        quality = Failed;
+        ninliers = 0;
+        rms = 0;
+        covariance.setZero();
+        match_time = estimation_time = refinement_time = 0;
+        
+        querycamera->node->pose = prior;
+        bool converged = false;
+        bool skipped = false;
+        bool good = refine( querycamera, start, 0, truncated, converged, skipped );
+        if ( good ) quality = ( truncated && !converged ) ? Partial : Refined;
+        
+        return good;
+    }
+    
+    // observation of a map point by one camera of a rig
+    struct RigObservation
+    {
+        Eigen::Vector3d X;          // map point
+        Eigen::Vector3d bearing;    // unit bearing in the rig frame
+        double focal;               // focal length of the observing camera, to report errors in pixels
+    };
+    
+    // error of a predicted point in the tangent plane of the observed bearing, with its derivative
+    static Eigen::Vector2d tangentError( const Eigen::Vector3d &bearing, const Eigen::Vector3d &PX, Eigen::Matrix<double,2,3> *dPX = NULL )
+    {
+        Eigen::Vector3d u = bearing.unitOrthogonal();
+        Eigen::Vector3d v = bearing.cross( u );
+        double s = bearing.dot( PX );
+        Eigen::Vector2d e( u.dot( PX ) / s, v.dot( PX ) / s );
+        if ( dPX != NULL )
+        {
+            dPX->row(0) = ( u - e[0] * bearing ).transpose() / s;
+            dPX->row(1) = ( v - e[1] * bearing ).transpose() / s;
+        }
+        return e;
+    }
+    
+    /**
+     * Refines the rig pose on its inlier observations by iteratively reweighted least squares with Tukey weights,
+     * in the same way as RobustLeastSq refines a single camera.
+     */
+    static void refineRigPose( const std::vector<RigObservation> &observations, double thresh, int niter, Sophus::SE3d &pose,
+                               int &ninliers, double &rms, Eigen::Matrix<double,6,6> &covariance )
+    {
+        double ksq = 4. * thresh * thresh;
+        double eps = 1e-3;
+        
+        Eigen::Matrix<double,6,6> JtJ;
+        double weightederr = 0;
+        double weightsum = 0;
+        
+        for ( int iter = 0; iter < niter; iter++ )
+        {
+            JtJ.setZero();
+            Eigen::Matrix<double,6,1> Jte = Eigen::Matrix<double,6,1>::Zero();
+            double toterr = 0;
+            weightederr = 0;
+            weightsum = 0;
+            
+            for ( size_t i = 0; i < observations.size(); i++ )
+            {
+                const RigObservation &obs = observations[i];
+                Eigen::Vector3d PX = pose * obs.X;
+                if ( obs.bearing.dot( PX ) <= 0 ) continue;
+                
+                Eigen::Matrix<double,2,3> A;
+                Eigen::Vector2d e = tangentError( obs.bearing, PX, &A );
+                
+                Eigen::Matrix<double,3,6> J;
+                for ( int m = 0; m < 6; m++ ) {
+                    J.col(m) = ( Sophus::SE3d::generator( m ) * unproject(PX) ).head(3);
+                }
+                Eigen::Matrix<double,2,6> F = A * J;
+                
+                double residsq = e.dot(e);
+                double w = ( residsq > ksq ) ? 0 : ( 1. - residsq/ksq ) * ( 1. - residsq/ksq );
+                
+                JtJ += F.transpose() * ( w * F );
+                Jte -= F.transpose() * ( w * e );
+                
+                toterr += std::min( residsq, ksq );
+                weightederr += w * residsq;
+                weightsum += w;
+            }
+            
+            Eigen::Matrix<double,6,6> damped = JtJ;
+            double avg_diag = JtJ.trace() / 6.;
+            for ( int m = 0; m < 6; m++ ) damped(m,m) += eps * avg_diag;
+            Eigen::Matrix<double,6,1> soln = damped.ldlt().solve( Jte );
+            Sophus::SE3d newpose = Sophus::SE3d::exp( soln ) * pose;
+            
+            double newerr = 0;
+            for ( size_t i = 0; i < observations.size(); i++ )
+            {
+                Eigen::Vector3d PX = newpose * observations[i].X;
+                if ( observations[i].bearing.dot( PX ) <= 0 ) { newerr += ksq; continue; }
+                Eigen::Vector2d e = tangentError( observations[i].bearing, PX );
+                newerr += std::min( e.dot(e), ksq );
+            }
+            
+            if ( newerr < toterr ) {
+                pose = newpose;
+                eps /= 10.;
+            } else {
+                eps *= 10.;
+            }
+        }
+        
+        // statistics at the final pose
+        ninliers = 0;
+        double errsq = 0;
+        for ( size_t i = 0; i < observations.size(); i++ )
+        {
+            Eigen::Vector3d PX = pose * observations[i].X;
+            if ( observations[i].bearing.dot( PX ) <= 0 ) continue;
+            Eigen::Vector2d e = tangentError( observations[i].bearing, PX );
+            if ( e.dot(e) > thresh * thresh ) continue;
+            errsq += e.dot(e) * observations[i].focal * observations[i].focal;
+            ninliers++;
+        }
+        rms = ( ninliers > 0 ) ? sqrt( errsq / ninliers ) : 0;
+        
+        covariance.setZero();
+        if ( ninliers >= 3 )
+        {
+            double dof = 2. * weightsum - 6.;
+            double sigmasq = ( dof > 0 ) ? weightederr / dof : 1.;
+            covariance = sigmasq * JtJ.ldlt().solve( Eigen::Matrix<double,6,6>::Identity() );
+        }
+    }
+    
+    bool NNLocalizer::localizeRig( Node *rignode )
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool have_budget = ( time_budget > 0 );
+        bool truncated = false;
+        quality = Failed;
+        ninliers = 0;
+        rms = 0;
+        covariance.setZero();
+        match_time = estimation_time = refinement_time = 0;
+        
+        // one batch for all cameras of the rig
+        std::vector<Match*> matches;
+        if ( !matchFeatures( rignode, start, matches, truncated ) ) return false;
+        
+        std::chrono::steady_clock::time_point estimation_start = std::chrono::steady_clock::now();
+        
+        PointPairList point_pairs;
+        std::vector<RigObservation> observations;
+        for ( size_t i = 0; i < matches.size(); i++ )
+        {
+            Feature *feature = matches[i]->feature1;
+            Feature *queryfeature = matches[i]->feature2;
+            
+            RigObservation obs;
+            obs.X = project( feature->track->point->position );
+            obs.bearing = queryfeature->globalUnproject( rignode ).normalized();
+            obs.focal = queryfeature->camera->calibration->focal;
+            observations.push_back( obs );
+            
+            point_pairs.push_back( PointPair( obs.X, obs.bearing ) );
+        }
+        
+        std::cout << point_pairs.size() << " matches for rig pose estimation\n";
+        
+        std::vector<bool> inliers;
+        RigThreePointPose estimator;
+        PROSAC prosac;
+        prosac.num_trials = 5000;
+        prosac.min_num_inliers = 100;
+        prosac.inlier_threshold = thresh;
+        if ( have_budget ) {
+            prosac.max_time = kEstimationDeadline * time_budget - secondsSince( start );
+            if ( prosac.max_time < 1e-3 ) prosac.max_time = 1e-3;
+        }
+        int nprosac = prosac.compute( point_pairs.begin(), point_pairs.end(), estimator, inliers );
+        if ( prosac.timed_out ) truncated = true;
+        estimation_time = secondsSince( estimation_start );
+        
+        std::cout << matches.size() << " matches; " << nprosac << " inliers\n";
+        ninliers = nprosac;
+        
+        bool good = ( nprosac >= prosac.min_num_inliers );
+        if ( good )
+        {
+            std::chrono::steady_clock::time_point refinement_start = std::chrono::steady_clock::now();
+            
+            std::vector<RigObservation> inlier_observations;
+            for ( size_t i = 0; i < inliers.size(); i++ )
+            {
+                if ( inliers[i] ) inlier_observations.push_back( observations[i] );
+            }
+            
+            Sophus::SE3d pose = estimator.pose;
+            refineRigPose( inlier_observations, thresh, 10, pose, ninliers, rms, covariance );
+            rignode->pose = pose;
+            
+            // link the query features to the map points, as localize() does
+            for ( size_t i = 0; i < inliers.size(); i++ )
+            {
+                if ( !inliers[i] ) continue;
+                Feature *queryfeature = matches[i]->feature2;
+                if ( queryfeature->track != NULL ) continue;
+                queryfeature->track = new Track;
+                queryfeature->track->point = matches[i]->feature1->track->point;
+            }
+            
+            refinement_time = secondsSince( refinement_start );
+            quality = ( truncated ) ? Partial : Refined;
+        }
+        
+        for ( size_t i = 0; i < matches.size(); i++ ) delete matches[i];
+        
+        if ( verbose && have_budget ) std::cout << "rig localization took " << secondsSince( start ) << " s of " << time_budget << " s budget\n";
+        
         return good;
     }
 }
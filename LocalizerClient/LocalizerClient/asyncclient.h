@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: asyncclient.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef ASYNC_CLIENT_H
+#define ASYNC_CLIENT_H
+
+#include <string>
+#include <deque>
+#include <map>
+#include <vector>
+#include <thread>
+#include <mutex>
+
+#include <LocalizerClient/protocol.h>
+
+namespace vrlt {
+
+/**
+ * \addtogroup Localizer
+ * @{
+ */
+
+    /**
+     * \brief Completion callback for an asynchronous localization request.
+     *
+     * \param context       The context pointer given to AsyncLocalizationClient::start().
+     * \param request_id    The id returned by AsyncLocalizationClient::sendImage().
+     * \param success       True if the server replied.  False if the request was dropped or the connection was lost.
+     * \param reply         The server's reply, or NULL if success is false.  For protocol versions before 2 only
+     *                      the pose and status are filled in.
+     */
+    typedef void (*LocalizationCallback)( void *context, int request_id, bool success, const LocalizationReply *reply );
+
+    /**
+     * \brief Non-blocking localization client.
+     *
+     * Requests are queued by sendImage() and sent from a background thread, which keeps up to
+     * max_in_flight requests outstanding on the connection.  If the connection is lost, outstanding
+     * requests are failed and the client reconnects in the background.  When more frames arrive than
+     * can be sent, the oldest unsent frame is dropped so that the server always sees the freshest image.
+     *
+     * Every request id gets exactly one callback, and the callbacks arrive in request order, including
+     * those of dropped and failed requests: a dropped frame is newer than the frames already in flight,
+     * so its callback is held back until theirs have been delivered.
+     */
+    class AsyncLocalizationClient
+    {
+    public:
+        AsyncLocalizationClient( int _scale, int _shift, int _max_in_flight = 2, int _max_queued = 1, int _version = 0 );
+        ~AsyncLocalizationClient();
+
+        /**
+         * \brief Starts the background thread, which connects to the server.
+         * The callback is invoked from the background thread.
+         */
+        bool start( const std::string &_servIP, int _portno, LocalizationCallback _callback, void *_context );
+
+        /** \brief Stops the background thread and fails any outstanding requests. */
+        void stop();
+
+        /**
+         * \brief Queues an image for localization.  Never blocks on the network.
+         * \param hint Optional location of the query.  Ignored for protocol version 0.
+         * \param down Optional direction of gravity in the camera frame.  Ignored before protocol version 3.
+         * \return The request id, which is passed to the callback on completion.
+         */
+        int sendImage( int nbytes, const unsigned char *bytes, const LocationHint *hint = NULL, const double *down = NULL );
+
+        bool isConnected();
+        int numInFlight();
+
+    protected:
+        struct Request
+        {
+            int id;
+            bool hasHint;
+            LocationHint hint;
+            bool hasDown;
+            double down[3];
+            std::vector<unsigned char> bytes;
+        };
+
+        void run();
+        bool connectToServer();
+        void disconnect( std::vector<int> &failed );
+        void wake();
+        void complete( int id, bool success, const LocalizationReply *reply );
+
+        int scale;
+        int shift;
+        int max_in_flight;
+        int max_queued;
+        int version;
+
+        std::string servIP;
+        int portno;
+        LocalizationCallback callback;
+        void *context;
+
+        std::thread thread;
+        std::mutex mutex;
+        bool running;
+        bool connected;
+        int next_id;
+        std::deque<Request*> queued;
+        std::deque<int> in_flight;
+        std::vector<int> dropped;
+
+        // completions waiting for an earlier request; only touched by the background thread
+        struct Completion
+        {
+            bool success;
+            LocalizationReply reply;
+        };
+        std::map<int,Completion> completed;
+        int next_callback;
+
+        int sock;
+        int wakefd[2];
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
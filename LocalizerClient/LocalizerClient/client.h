@@ -13,6 +13,8 @@
 
 #include <string>
 
+#include <LocalizerClient/protocol.h>
+
 namespace vrlt {
 
 /**
@@ -23,16 +25,32 @@ namespace vrlt {
     class LocalizationClient
     {
     public:
-        LocalizationClient( int _scale, int _shift );
+        /**
+         * \param _version Protocol version to speak; see protocol.h.  Version 0 is understood by every server.
+         */
+        LocalizationClient( int _scale, int _shift, int _version = 0 );
         ~LocalizationClient();
         
         bool connectToServer( const std::string &servIP, int portno );
-        bool sendImage( int nbytes, unsigned char *bytes );
+        /**
+         * \param hint Optional location of the query, used by multi-map servers.  Ignored for protocol version 0.
+         * \param down Optional direction of gravity in the camera frame, e.g. from the device attitude.  Ignored before protocol version 3.
+         */
+        bool sendImage( int nbytes, unsigned char *bytes, const LocationHint *hint = NULL, const double *down = NULL );
+        /**
+         * \brief Receives the pose for the last image sent.  Works with every protocol version.
+         */
         bool recvPose( double *posedata );
+        /**
+         * \brief Receives the full reply for the last image sent.
+         * For protocol versions before 2 only the pose is filled in, and the status is guessed from it.
+         */
+        bool recvReply( LocalizationReply *reply );
     protected:
         int sock;
         int scale;
         int shift;
+        int version;
     };
 
 /**
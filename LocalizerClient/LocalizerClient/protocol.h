@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: protocol.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef LOCALIZER_PROTOCOL_H
+#define LOCALIZER_PROTOCOL_H
+
+/**
+ * \addtogroup Localizer
+ * @{
+ */
+
+/**
+ * Version of the client/server protocol spoken by this client.
+ *
+ * The connection header is two ints, { scale, shift }.  Clients newer than version 0
+ * put their protocol version in the upper 16 bits of the scale field, so old clients
+ * (which send version 0) keep working unchanged.
+ *
+ * Version 0: each request is an int byte count followed by the JPEG data; the reply is six doubles (the SE3 log of the pose).
+ * Version 1: each request starts with a RequestHeader instead of the byte count, which can carry a location hint.
+ * Version 2: the reply is a LocalizationReply instead of six doubles.
+ * Version 3: the RequestHeader ends with the direction of gravity, which versions 1 and 2 do not send.
+ */
+#define LOCALIZER_PROTOCOL_VERSION 3
+
+namespace vrlt {
+
+    inline int packScaleAndVersion( int scale, int version ) { return ( scale & 0xFFFF ) | ( version << 16 ); }
+    inline int unpackScale( int data ) { return data & 0xFFFF; }
+    inline int unpackVersion( int data ) { return ( data >> 16 ) & 0xFFFF; }
+
+    /** \brief Approximate location of the query, used by the server to choose a map. */
+    struct LocationHint
+    {
+        int utmZone;
+        bool utmNorth;
+        double easting;
+        double northing;
+        LocationHint() : utmZone( 0 ), utmNorth( true ), easting( 0 ), northing( 0 ) { }
+    };
+
+    enum RequestFlags
+    {
+        RequestHasLocation = 1,
+        RequestHasGravity = 2
+    };
+
+    /** \brief Request header sent before the JPEG data from protocol version 1 on. */
+    struct RequestHeader
+    {
+        int datasize;       ///< Number of JPEG bytes following the header.
+        int flags;          ///< Combination of RequestFlags.
+        int utmZone;
+        int utmNorth;
+        double easting;
+        double northing;
+        double down[3];     ///< Direction of gravity in the camera frame (x right, y down, z forward).  Version 3 and up.
+    };
+    
+    /** \brief Size of the RequestHeader sent by a client of the given protocol version. */
+    inline int requestHeaderSize( int version )
+    {
+        if ( version >= 3 ) return sizeof(RequestHeader);
+        if ( version >= 1 ) return sizeof(RequestHeader) - 3*sizeof(double);
+        return sizeof(int);
+    }
+
+    /** \brief Outcome of a localization request. */
+    enum ReplyStatus
+    {
+        ReplyFailed = 0,    ///< No pose was found; the pose is the identity.
+        ReplyCoarse,        ///< Pose from robust estimation only; refinement was skipped to meet the server's time budget.
+        ReplyPartial,       ///< A stage was cut short to meet the server's time budget.
+        ReplyRefined        ///< Fully refined pose.
+    };
+
+    /** \brief Reply sent for each request from protocol version 2 on. */
+    struct LocalizationReply
+    {
+        double pose[6];             ///< SE3 log of the pose, as sent in version 0.
+        int status;                 ///< One of ReplyStatus.
+        int ninliers;               ///< Number of inlier points supporting the pose.
+        double rms;                 ///< RMS reprojection error of the inliers in pixels, or zero if unknown.
+        double covariance[36];      ///< Row-major covariance of a left update exp(d)*pose, with d ordered as in the pose log.  All zero if unknown.
+        
+        // server-side time spent on each stage of the request, in seconds
+        double receiveTime;         ///< Receiving the image data after its header arrived.
+        double decodeTime;          ///< Decoding the JPEG.
+        double extractTime;         ///< Extracting features.
+        double matchTime;           ///< Matching features against the map.
+        double estimationTime;      ///< Robust pose estimation.
+        double refinementTime;      ///< Tracking and pose refinement.
+        double totalTime;           ///< From receiving the header to sending the reply.
+    };
+
+}
+
+/**
+ * @}
+ */
+
+#endif
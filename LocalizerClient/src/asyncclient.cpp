@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: asyncclient.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <LocalizerClient/asyncclient.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace vrlt {
+
+    // time allowed for connect() before we back off and retry
+    static const int kConnectTimeoutMs = 2000;
+    static const int kMinBackoffMs = 250;
+    static const int kMaxBackoffMs = 5000;
+
+    static bool sendAll( int sock, const void *data, size_t nbytes )
+    {
+        const unsigned char *ptr = (const unsigned char *)data;
+        while ( nbytes > 0 )
+        {
+            ssize_t nsent = send( sock, ptr, nbytes, MSG_NOSIGNAL );
+            if ( nsent < 0 && errno == EINTR ) continue;
+            if ( nsent <= 0 ) return false;
+            ptr += nsent;
+            nbytes -= nsent;
+        }
+        return true;
+    }
+
+    static bool recvAll( int sock, void *data, size_t nbytes )
+    {
+        unsigned char *ptr = (unsigned char *)data;
+        while ( nbytes > 0 )
+        {
+            ssize_t nrecvd = recv( sock, ptr, nbytes, 0 );
+            if ( nrecvd < 0 && errno == EINTR ) continue;
+            if ( nrecvd <= 0 ) return false;
+            ptr += nrecvd;
+            nbytes -= nrecvd;
+        }
+        return true;
+    }
+
+    AsyncLocalizationClient::AsyncLocalizationClient( int _scale, int _shift, int _max_in_flight, int _max_queued, int _version )
+    : scale( _scale ), shift( _shift ), max_in_flight( _max_in_flight ), max_queued( _max_queued ), version( _version ),
+      portno( 0 ), callback( NULL ), context( NULL ),
+      running( false ), connected( false ), next_id( 0 ), next_callback( 0 ), sock( -1 )
+    {
+        if ( max_in_flight < 1 ) max_in_flight = 1;
+        if ( max_queued < 1 ) max_queued = 1;
+        wakefd[0] = wakefd[1] = -1;
+    }
+
+    AsyncLocalizationClient::~AsyncLocalizationClient()
+    {
+        stop();
+    }
+
+    bool AsyncLocalizationClient::start( const std::string &_servIP, int _portno, LocalizationCallback _callback, void *_context )
+    {
+        if ( running ) return false;
+
+        if ( pipe( wakefd ) != 0 ) return false;
+        fcntl( wakefd[0], F_SETFL, O_NONBLOCK );
+        fcntl( wakefd[1], F_SETFL, O_NONBLOCK );
+
+        servIP = _servIP;
+        portno = _portno;
+        callback = _callback;
+        context = _context;
+
+        running = true;
+        thread = std::thread( &AsyncLocalizationClient::run, this );
+
+        return true;
+    }
+
+    void AsyncLocalizationClient::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( !running ) return;
+            running = false;
+        }
+
+        wake();
+        thread.join();
+
+        close( wakefd[0] );
+        close( wakefd[1] );
+        wakefd[0] = wakefd[1] = -1;
+    }
+
+    int AsyncLocalizationClient::sendImage( int nbytes, const unsigned char *bytes, const LocationHint *hint, const double *down )
+    {
+        Request *request = new Request;
+        request->bytes.assign( bytes, bytes + nbytes );
+        request->hasHint = ( hint != NULL );
+        if ( hint != NULL ) request->hint = *hint;
+        request->hasDown = ( down != NULL );
+        if ( down != NULL ) memcpy( request->down, down, 3*sizeof(double) );
+
+        int id;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            id = request->id = next_id++;
+
+            // keep only the freshest frames waiting to be sent
+            while ( (int)queued.size() >= max_queued )
+            {
+                Request *oldest = queued.front();
+                queued.pop_front();
+                dropped.push_back( oldest->id );
+                delete oldest;
+            }
+            queued.push_back( request );
+        }
+
+        wake();
+
+        return id;
+    }
+
+    bool AsyncLocalizationClient::isConnected()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        return connected;
+    }
+
+    int AsyncLocalizationClient::numInFlight()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        return (int)in_flight.size();
+    }
+
+    void AsyncLocalizationClient::wake()
+    {
+        char c = 0;
+        if ( write( wakefd[1], &c, 1 ) < 0 ) {
+            // pipe is full, so the background thread is already due to wake up
+        }
+    }
+
+    void AsyncLocalizationClient::complete( int id, bool success, const LocalizationReply *reply )
+    {
+        Completion &completion = completed[id];
+        completion.success = success;
+        if ( success ) completion.reply = *reply;
+
+        // deliver everything up to the first request that is still outstanding
+        std::map<int,Completion>::iterator it;
+        while ( ( it = completed.find( next_callback ) ) != completed.end() )
+        {
+            if ( callback ) callback( context, it->first, it->second.success, ( it->second.success ) ? &it->second.reply : NULL );
+            completed.erase( it );
+            next_callback++;
+        }
+    }
+
+    bool AsyncLocalizationClient::connectToServer()
+    {
+        int newsock = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+        if ( newsock < 0 ) return false;
+
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt( newsock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on) );
+#endif
+
+        struct sockaddr_in servAddr;
+        memset( &servAddr, 0, sizeof(servAddr) );
+        servAddr.sin_family = AF_INET;
+        servAddr.sin_addr.s_addr = inet_addr(servIP.c_str());
+        servAddr.sin_port = htons(portno);
+
+        // connect without blocking so that stop() is never held up by an unreachable server
+        int flags = fcntl( newsock, F_GETFL, 0 );
+        fcntl( newsock, F_SETFL, flags | O_NONBLOCK );
+        int result = connect( newsock, (struct sockaddr *)&servAddr, sizeof(servAddr) );
+        if ( result < 0 && errno == EINPROGRESS )
+        {
+            struct pollfd fds[2];
+            fds[0].fd = newsock;
+            fds[0].events = POLLOUT;
+            fds[1].fd = wakefd[0];
+            fds[1].events = POLLIN;
+            result = -1;
+            if ( poll( fds, 2, kConnectTimeoutMs ) > 0 && ( fds[0].revents & POLLOUT ) )
+            {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                if ( getsockopt( newsock, SOL_SOCKET, SO_ERROR, &error, &len ) == 0 && error == 0 ) result = 0;
+            }
+        }
+        fcntl( newsock, F_SETFL, flags );
+
+        if ( result < 0 )
+        {
+            close( newsock );
+            return false;
+        }
+
+        // send header information
+        int data[2] = { packScaleAndVersion( scale, version ), shift };
+        if ( !sendAll( newsock, data, 2*sizeof(int) ) )
+        {
+            close( newsock );
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock( mutex );
+        sock = newsock;
+        connected = true;
+
+        return true;
+    }
+
+    void AsyncLocalizationClient::disconnect( std::vector<int> &failed )
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        if ( sock >= 0 ) close( sock );
+        sock = -1;
+        connected = false;
+
+        // replies to these will never arrive
+        failed.insert( failed.end(), in_flight.begin(), in_flight.end() );
+        in_flight.clear();
+    }
+
+    void AsyncLocalizationClient::run()
+    {
+        int backoff = kMinBackoffMs;
+        std::vector<int> failed;
+
+        for ( ; ; )
+        {
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                stopping = !running;
+                failed.insert( failed.end(), dropped.begin(), dropped.end() );
+                dropped.clear();
+            }
+
+            for ( size_t i = 0; i < failed.size(); i++ ) complete( failed[i], false, NULL );
+            failed.clear();
+
+            if ( stopping ) break;
+
+            if ( sock < 0 )
+            {
+                if ( connectToServer() )
+                {
+                    backoff = kMinBackoffMs;
+                }
+                else
+                {
+                    // wait before retrying, but wake up for stop() or new frames
+                    struct pollfd fds;
+                    fds.fd = wakefd[0];
+                    fds.events = POLLIN;
+                    poll( &fds, 1, backoff );
+                    char buf[64];
+                    while ( read( wakefd[0], buf, sizeof(buf) ) > 0 ) { }
+                    backoff *= 2;
+                    if ( backoff > kMaxBackoffMs ) backoff = kMaxBackoffMs;
+                    continue;
+                }
+            }
+
+            // send as many queued requests as the pipeline allows
+            for ( ; ; )
+            {
+                Request *request = NULL;
+                {
+                    std::lock_guard<std::mutex> lock( mutex );
+                    if ( !queued.empty() && (int)in_flight.size() < max_in_flight )
+                    {
+                        request = queued.front();
+                        queued.pop_front();
+                        in_flight.push_back( request->id );
+                    }
+                }
+                if ( request == NULL ) break;
+
+                int nbytes = (int)request->bytes.size();
+                bool good;
+                if ( version >= 1 )
+                {
+                    RequestHeader header;
+                    memset( &header, 0, sizeof(header) );
+                    header.datasize = nbytes;
+                    if ( request->hasHint )
+                    {
+                        header.flags |= RequestHasLocation;
+                        header.utmZone = request->hint.utmZone;
+                        header.utmNorth = ( request->hint.utmNorth ) ? 1 : 0;
+                        header.easting = request->hint.easting;
+                        header.northing = request->hint.northing;
+                    }
+                    if ( request->hasDown && version >= 3 )
+                    {
+                        header.flags |= RequestHasGravity;
+                        memcpy( header.down, request->down, 3*sizeof(double) );
+                    }
+                    good = sendAll( sock, &header, requestHeaderSize( version ) );
+                }
+                else
+                {
+                    good = sendAll( sock, &nbytes, sizeof(int) );
+                }
+                if ( good ) good = sendAll( sock, &request->bytes[0], nbytes );
+                delete request;
+
+                if ( !good )
+                {
+                    disconnect( failed );
+                    break;
+                }
+            }
+            if ( sock < 0 ) continue;
+
+            struct pollfd fds[2];
+            fds[0].fd = sock;
+            fds[0].events = POLLIN;
+            fds[1].fd = wakefd[0];
+            fds[1].events = POLLIN;
+            if ( poll( fds, 2, -1 ) < 0 ) continue;
+
+            if ( fds[1].revents & POLLIN )
+            {
+                char buf[64];
+                while ( read( wakefd[0], buf, sizeof(buf) ) > 0 ) { }
+            }
+
+            if ( fds[0].revents & ( POLLIN | POLLERR | POLLHUP ) )
+            {
+                // before version 2 the reply is just the pose
+                LocalizationReply reply;
+                memset( &reply, 0, sizeof(reply) );
+                int replysize = ( version >= 2 ) ? sizeof(reply) : 6*sizeof(double);
+                if ( !recvAll( sock, &reply, replysize ) )
+                {
+                    disconnect( failed );
+                    continue;
+                }
+                if ( version < 2 )
+                {
+                    reply.status = ReplyFailed;
+                    for ( int i = 0; i < 6; i++ ) if ( reply.pose[i] != 0 ) reply.status = ReplyRefined;
+                }
+
+                int id = -1;
+                {
+                    std::lock_guard<std::mutex> lock( mutex );
+                    if ( !in_flight.empty() )
+                    {
+                        id = in_flight.front();
+                        in_flight.pop_front();
+                    }
+                }
+                if ( id >= 0 ) complete( id, true, &reply );
+            }
+        }
+
+        // fail whatever is left
+        disconnect( failed );
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            for ( size_t i = 0; i < queued.size(); i++ )
+            {
+                failed.push_back( queued[i]->id );
+                delete queued[i];
+            }
+            queued.clear();
+            failed.insert( failed.end(), dropped.begin(), dropped.end() );
+            dropped.clear();
+        }
+        for ( size_t i = 0; i < failed.size(); i++ ) complete( failed[i], false, NULL );
+    }
+
+}
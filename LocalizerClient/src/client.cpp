@@ -12,8 +12,8 @@
 
 namespace vrlt {
     
-    LocalizationClient::LocalizationClient( int _scale, int _shift )
-    : sock( -1 ), scale( _scale ), shift( _shift )
+    LocalizationClient::LocalizationClient( int _scale, int _shift, int _version )
+    : sock( -1 ), scale( _scale ), shift( _shift ), version( _version )
     {
 
     }
@@ -44,7 +44,7 @@ namespace vrlt {
         }
         
         // send header information
-        int data[2] = { scale, shift };
+        int data[2] = { packScaleAndVersion( scale, version ), shift };
         if ( send( sock, data, 2*sizeof(int), 0 ) != 2*sizeof(int) )
         {
             close( sock );
@@ -55,9 +55,36 @@ namespace vrlt {
         return true;
     }
 
-    bool LocalizationClient::sendImage( int nbytes, unsigned char *bytes )
+    bool LocalizationClient::sendImage( int nbytes, unsigned char *bytes, const LocationHint *hint, const double *down )
     {
-        if ( send( sock, &nbytes, sizeof(int), 0 ) != sizeof(int) )
+        if ( version >= 1 )
+        {
+            RequestHeader header;
+            memset( &header, 0, sizeof(header) );
+            header.datasize = nbytes;
+            if ( hint != NULL )
+            {
+                header.flags |= RequestHasLocation;
+                header.utmZone = hint->utmZone;
+                header.utmNorth = ( hint->utmNorth ) ? 1 : 0;
+                header.easting = hint->easting;
+                header.northing = hint->northing;
+            }
+            if ( down != NULL && version >= 3 )
+            {
+                header.flags |= RequestHasGravity;
+                memcpy( header.down, down, 3*sizeof(double) );
+            }
+            
+            int headersize = requestHeaderSize( version );
+            if ( send( sock, &header, headersize, 0 ) != headersize )
+            {
+                close( sock );
+                sock = -1;
+                return false;
+            }
+        }
+        else if ( send( sock, &nbytes, sizeof(int), 0 ) != sizeof(int) )
         {
             close( sock );
             sock = -1;
@@ -76,12 +103,25 @@ namespace vrlt {
 
     bool LocalizationClient::recvPose( double *posedata )
     {
-        unsigned char *ptr = (unsigned char *)posedata;
+        LocalizationReply reply;
+        if ( !recvReply( &reply ) ) return false;
+        memcpy( posedata, reply.pose, 6*sizeof(double) );
+        return true;
+    }
+
+    bool LocalizationClient::recvReply( LocalizationReply *reply )
+    {
+        memset( reply, 0, sizeof(LocalizationReply) );
+        
+        // before version 2 the reply is just the pose
+        int replysize = ( version >= 2 ) ? sizeof(LocalizationReply) : 6*sizeof(double);
+        
+        unsigned char *ptr = (unsigned char *)reply;
         int totalrecvd = 0;
-        while ( totalrecvd < 6*sizeof(double) )
+        while ( totalrecvd < replysize )
         {
-            int bytesrecvd = recv( sock, ptr, 6*sizeof(double) - totalrecvd, 0 );
-            if ( bytesrecvd < 0 )
+            int bytesrecvd = recv( sock, ptr, replysize - totalrecvd, 0 );
+            if ( bytesrecvd <= 0 )
             {
                 close( sock );
                 sock = -1;
@@ -92,6 +132,13 @@ namespace vrlt {
             totalrecvd += bytesrecvd;
         }
         
+        if ( version < 2 )
+        {
+            // old servers reply with the identity when localization fails
+            reply->status = ReplyFailed;
+            for ( int i = 0; i < 6; i++ ) if ( reply->pose[i] != 0 ) reply->status = ReplyRefined;
+        }
+        
         return true;
     }
 
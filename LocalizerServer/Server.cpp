@@ -14,13 +14,20 @@
 #include <FeatureMatcher/bruteforce.h>
 #include <PatchTracker/tracker.h>
 #include <Localizer/nnlocalizer.h>
+#include <ImageCache/imagecache.h>
+#include <LocalizerClient/protocol.h>
+#include <MultiView/parallel.h>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#ifdef USE_DISPATCH
-#include <dispatch/dispatch.h>
-#endif
+#include <cerrno>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <csignal>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -44,22 +51,163 @@ public:
     }
 };
 
+// margin in meters around the camera centers of a map within which location hints are routed to it
+#define SHARD_MARGIN 100.
+// number of nearest maps tried when a location hint falls outside of all maps
+#define MAX_NEAREST_SHARDS 2
+
+/** One map loaded into the server, with its own index and tracker. */
+struct Shard
+{
+    Shard() : root( NULL ), index( NULL ), localizer( NULL ), images( NULL ) { }
+    ~Shard()
+    {
+        delete localizer;
+        delete images;
+        delete index;
+        clearReconstruction( r );
+    }
+    
+    std::string path;
+    Reconstruction r;
+    Node *root;
+    NN *index;
+    NNLocalizer *localizer;
+    PatchAtlas atlas;       // templates for the tracker, if the shard has an atlas; its images are not loaded then
+    ImageProvider *images;  // loads the images as the tracker needs them, if there is no atlas and a memory budget was given
+    
+    // the tracker writes tracking state into the map points, so only one query runs on a shard at a time
+    std::mutex mutex;
+    
+    // whether gravity is along +y in the map, so that queries can use the two point gravity solver
+    bool gravityAligned;
+    
+    // UTM bounds of the camera centers, if the map is geo-registered
+    bool georegistered;
+    double minEast, maxEast, minNorth, maxNorth;
+    
+    // translation from the server's reference frame (that of the first map) to this map's frame
+    Eigen::Vector3d offset;
+    
+    double distanceTo( const RequestHeader &header ) const
+    {
+        double dx = std::max( 0., std::max( minEast - header.easting, header.easting - maxEast ) );
+        double dy = std::max( 0., std::max( minNorth - header.northing, header.northing - maxNorth ) );
+        return sqrt( dx*dx + dy*dy );
+    }
+};
+
+/**
+ * The set of maps being served.
+ * Connections hold a reference for the duration of each request, so when a reload
+ * swaps in a new set, requests already running finish on the old maps, which are
+ * freed when the last reference is released.
+ */
+struct MapSet
+{
+    std::vector<Shard*> shards;
+    int generation;
+    
+    MapSet() : generation( 0 ) { }
+    ~MapSet()
+    {
+        for ( size_t i = 0; i < shards.size(); i++ ) delete shards[i];
+    }
+};
+
+// the maps new requests are served from; only read and written with std::atomic_load/atomic_store
+static std::shared_ptr<MapSet> currentMaps;
+
+// bytes of images each shard without an atlas keeps loaded; zero loads them all up front
+static size_t imageBudget = 0;
+
+typedef std::chrono::steady_clock Clock;
+
+/** Per-connection query state for one shard. */
+struct ShardQuery
+{
+    Shard *shard;
+    Node *node;
+    Camera *camera;
+    std::vector<Feature*> features;
+    std::vector<Feature*> copies;   // feature copies kept between requests, of which features uses the first few
+    double time_budget;         // seconds for the whole request, or zero for no budget
+    Clock::time_point received; // arrival of the request, from which the budget runs
+    bool has_gravity;
+    Eigen::Vector3d gravity;
+    bool seeded;                // refine prior with the tracker instead of localizing from feature matches
+    Sophus::SE3d prior;
+    
+    bool success;
+    int ntracked;
+    Sophus::SE3d pose;
+    LocalizationReply reply;    // statistics and timings of the query; the pose is filled in when it is sent
+};
+
+static double secondsSince( const Clock::time_point &start )
+{
+    return std::chrono::duration<double>( Clock::now() - start ).count();
+}
+
+// recent results remembered per connection
+#define CACHE_SIZE 4
+// seconds for which a result may answer later frames; a stationary device is relocalized at least this often
+#define CACHE_MAX_AGE 5.
+// thumbnail correlation above which a frame is answered with the cached result as is
+#define CACHE_REUSE_CORR 0.995f
+// thumbnail correlation above which the cached pose seeds the tracker in place of feature matching
+#define CACHE_SEED_CORR 0.95f
+
+/** A recent result of a connection, kept to answer near-duplicate frames such as retries or those of a stationary device. */
+struct CachedResult
+{
+    cv::Mat signature;          // blurred, normalized thumbnail of the query image, from ImageCache::prepareSmallImage
+    Clock::time_point time;
+    Shard *shard;               // map the query was localized in
+    Sophus::SE3d shardPose;     // pose in that map's frame
+    Sophus::SE3d pose;          // pose in the server's reference frame
+    LocalizationReply reply;
+};
+
+static void runShardQuery( ShardQuery *query )
+{
+    Shard *shard = query->shard;
+    std::lock_guard<std::mutex> lock( shard->mutex );
+    
+    // time spent waiting for the shard counts against the request, so the budget is only worked out now
+    double remaining_budget = 0;
+    if ( query->time_budget > 0 ) remaining_budget = std::max( query->time_budget - secondsSince( query->received ), 1e-3 );
+    shard->localizer->time_budget = remaining_budget;
+    // under a time budget, cut tracker refinement short once the pose has settled
+    shard->localizer->adaptive_refinement = ( query->time_budget > 0 );
+    shard->localizer->has_gravity = ( query->has_gravity && shard->gravityAligned );
+    shard->localizer->gravity = query->gravity;
+    if ( query->seeded ) query->success = shard->localizer->localizeFrom( query->camera, query->prior );
+    else query->success = shard->localizer->localize( query->camera );
+    query->ntracked = shard->localizer->tracker->ntracked;
+    
+    Localizer *localizer = shard->localizer;
+    LocalizationReply &reply = query->reply;
+    memset( &reply, 0, sizeof(reply) );
+    // ReplyStatus has the same values as Localizer::Quality
+    reply.status = ( query->success ) ? (int)localizer->quality : ReplyFailed;
+    reply.ninliers = localizer->ninliers;
+    reply.rms = localizer->rms;
+    Eigen::Map< Eigen::Matrix<double,6,6,Eigen::RowMajor> >( reply.covariance ) = localizer->covariance;
+    reply.matchTime = localizer->match_time;
+    reply.estimationTime = localizer->estimation_time;
+    reply.refinementTime = localizer->refinement_time;
+    
+    // express the pose in the server's reference frame
+    if ( query->success ) query->pose = query->node->pose * Sophus::SE3d( Sophus::SO3d(), shard->offset );
+}
+
 class ServerThread
 {
 public:
-    ServerThread( Node *_root, Calibration *_calibration, cv::Size _imsize, int _clntSock )
-    : root( _root ), imsize( _imsize ), clntSock( _clntSock )
+    ServerThread( Calibration *_calibration, cv::Size _imsize, int _clntSock, double _time_budget )
+    : imsize( _imsize ), localizedIn( NULL ), clntSock( _clntSock ), time_budget( _time_budget ), version( 0 )
     {
-        index = new BruteForceNN;
-        
-        localizer = new NNLocalizer( root, index );
-        localizer->verbose = true;
-        //        localizer->tracker->firstlevel = 3;
-        //        localizer->tracker->lastlevel = 1;
-        localizer->tracker->minnumpoints = 200;
-        localizer->thresh = 0.006 * imsize.width / _calibration->focal;
-        //        localizer->thresh *= 2.;
-        
         querynode = new Node;
         querynode->name = "querynode";
         
@@ -82,6 +230,249 @@ public:
         delete [] buffer;
     }
     
+    /** Picks up the latest map set, if it has changed since the last request. */
+    void updateMaps()
+    {
+        std::shared_ptr<MapSet> latest = std::atomic_load( &currentMaps );
+        if ( latest == maps ) return;
+        
+        deleteQueries();
+        maps = latest;
+        
+        // cached results refer to the old maps
+        cache.clear();
+        
+        for ( size_t i = 0; i < maps->shards.size(); i++ )
+        {
+            ShardQuery *query = new ShardQuery;
+            query->shard = maps->shards[i];
+            query->node = new Node;
+            query->node->name = "querynode";
+            query->camera = new Camera;
+            query->camera->name = "querycamera";
+            query->camera->node = query->node;
+            query->camera->calibration = querycalibration;
+            query->node->camera = query->camera;
+            queries.push_back( query );
+        }
+    }
+    
+    void deleteQueries()
+    {
+        for ( size_t i = 0; i < queries.size(); i++ )
+        {
+            for ( size_t j = 0; j < queries[i]->copies.size(); j++ )
+            {
+                queries[i]->copies[j]->descriptor = NULL;
+                delete queries[i]->copies[j];
+            }
+            delete queries[i]->camera;
+            delete queries[i]->node;
+            delete queries[i];
+        }
+        queries.clear();
+    }
+    
+    void selectShards( std::vector<ShardQuery*> &selected )
+    {
+        selected.clear();
+        
+        if ( header.flags & RequestHasLocation )
+        {
+            std::vector< std::pair<double,ShardQuery*> > nearest;
+            for ( size_t i = 0; i < queries.size(); i++ )
+            {
+                Shard *shard = queries[i]->shard;
+                if ( !shard->georegistered ) continue;
+                if ( shard->r.utmZone != header.utmZone || shard->r.utmNorth != ( header.utmNorth != 0 ) ) continue;
+                
+                double distance = shard->distanceTo( header );
+                if ( distance <= SHARD_MARGIN ) selected.push_back( queries[i] );
+                else nearest.push_back( std::make_pair( distance, queries[i] ) );
+            }
+            
+            if ( selected.empty() )
+            {
+                std::sort( nearest.begin(), nearest.end() );
+                for ( size_t i = 0; i < nearest.size() && i < MAX_NEAREST_SHARDS; i++ ) selected.push_back( nearest[i].second );
+            }
+        }
+        
+        // no usable hint: try every map
+        if ( selected.empty() ) selected = queries;
+    }
+    
+    void prepareQuery( ShardQuery *query )
+    {
+        query->camera->image = querycamera->image;
+        query->camera->pyramid = querycamera->pyramid;
+        
+        // each shard gets its own copies of the query features, since localization links them to map points
+        ElementList::iterator it;
+        for ( it = querycamera->features.begin(); it != querycamera->features.end(); it++ )
+        {
+            Feature *feature = (Feature *)it->second;
+            if ( query->features.size() == query->copies.size() ) query->copies.push_back( new Feature );
+            Feature *copy = query->copies[query->features.size()];
+            copy->name = feature->name;
+            copy->camera = query->camera;
+            copy->location = feature->location;
+            copy->orientation = feature->orientation;
+            copy->scale = feature->scale;
+            copy->descriptor = feature->descriptor;
+            query->features.push_back( copy );
+            query->camera->features[copy->name] = copy;
+        }
+        
+        query->node->pose = Sophus::SE3d();
+        query->seeded = false;
+        query->success = false;
+        query->ntracked = 0;
+    }
+    
+    void clearQuery( ShardQuery *query )
+    {
+        for ( size_t i = 0; i < query->features.size(); i++ )
+        {
+            Feature *copy = query->features[i];
+            delete copy->track;
+            copy->track = NULL;
+            copy->matches.clear();
+        }
+        query->features.clear();
+        query->camera->features.clear();
+    }
+    
+    /** Copies the statistics and localization timings of a shard query into the reply, keeping the other timings. */
+    void copyStatistics( const LocalizationReply &from )
+    {
+        reply.status = from.status;
+        reply.ninliers = from.ninliers;
+        reply.rms = from.rms;
+        memcpy( reply.covariance, from.covariance, sizeof(reply.covariance) );
+        reply.matchTime = from.matchTime;
+        reply.estimationTime = from.estimationTime;
+        reply.refinementTime = from.refinementTime;
+    }
+    
+    bool localize( const Clock::time_point &received, Sophus::SE3d &pose )
+    {
+        std::vector<ShardQuery*> selected;
+        selectShards( selected );
+        
+        for ( size_t i = 0; i < selected.size(); i++ )
+        {
+            prepareQuery( selected[i] );
+            selected[i]->time_budget = time_budget;
+            selected[i]->received = received;
+            selected[i]->has_gravity = ( header.flags & RequestHasGravity ) != 0;
+            if ( selected[i]->has_gravity ) selected[i]->gravity = Eigen::Vector3d( header.down[0], header.down[1], header.down[2] ).normalized();
+        }
+        
+        // query the shards in parallel
+        TaskGroup group;
+        for ( size_t i = 1; i < selected.size(); i++ )
+        {
+            ShardQuery *query = selected[i];
+            group.run( [query]{ runShardQuery( query ); } );
+        }
+        runShardQuery( selected[0] );
+        group.wait();
+        
+        ShardQuery *best = NULL;
+        for ( size_t i = 0; i < selected.size(); i++ )
+        {
+            if ( !selected[i]->success ) continue;
+            if ( best == NULL || selected[i]->ntracked > best->ntracked ) best = selected[i];
+        }
+        
+        localizedIn = best;
+        if ( best != NULL )
+        {
+            pose = best->pose;
+            copyStatistics( best->reply );
+            std::cout << "localized in " << best->shard->path << "\n";
+        }
+        
+        else
+        {
+            // report how close the most promising map came
+            ShardQuery *closest = selected[0];
+            for ( size_t i = 1; i < selected.size(); i++ ) if ( selected[i]->reply.ninliers > closest->reply.ninliers ) closest = selected[i];
+            copyStatistics( closest->reply );
+            reply.status = ReplyFailed;
+        }
+        
+        for ( size_t i = 0; i < selected.size(); i++ ) clearQuery( selected[i] );
+        
+        return ( best != NULL );
+    }
+    
+    /** Finds the unexpired cached result whose query image is most like the current one, if any is near enough to use. */
+    CachedResult * findCachedResult( float &bestCorr )
+    {
+        CachedResult *best = NULL;
+        bestCorr = -1.f;
+        for ( size_t i = 0; i < cache.size(); i++ )
+        {
+            CachedResult &cached = cache[i];
+            if ( std::chrono::duration<double>( requestStart - cached.time ).count() > CACHE_MAX_AGE ) continue;
+            if ( cached.signature.size() != querycamera->small_image.size() ) continue;
+            
+            float corr = getCorr( cached.signature, querycamera->small_image );
+            if ( corr > bestCorr )
+            {
+                bestCorr = corr;
+                best = &cached;
+            }
+        }
+        
+        if ( bestCorr < CACHE_SEED_CORR ) return NULL;
+        return best;
+    }
+    
+    void addCachedResult( const Sophus::SE3d &pose )
+    {
+        if ( cache.size() >= CACHE_SIZE ) cache.erase( cache.begin() );
+        
+        CachedResult cached;
+        cached.signature = querycamera->small_image.clone();
+        cached.time = requestStart;
+        cached.shard = localizedIn->shard;
+        cached.shardPose = localizedIn->node->pose;
+        cached.pose = pose;
+        cached.reply = reply;
+        cache.push_back( cached );
+    }
+    
+    /** Localizes the query by tracking from the pose of a similar recent frame, skipping feature extraction and matching. */
+    bool localizeFromCache( CachedResult *cached, const Clock::time_point &received, Sophus::SE3d &pose )
+    {
+        ShardQuery *query = NULL;
+        for ( size_t i = 0; i < queries.size(); i++ ) if ( queries[i]->shard == cached->shard ) query = queries[i];
+        localizedIn = NULL;
+        if ( query == NULL ) return false;
+        
+        prepareQuery( query );
+        query->time_budget = time_budget;
+        query->received = received;
+        query->has_gravity = false;
+        query->seeded = true;
+        query->prior = cached->shardPose;
+        runShardQuery( query );
+        
+        if ( query->success )
+        {
+            localizedIn = query;
+            pose = query->pose;
+            copyStatistics( query->reply );
+        }
+        
+        clearQuery( query );
+        
+        return query->success;
+    }
+    
     unsigned char * unpackBytes( unsigned char *ptr, char *bufferptr, int recvMsgSize )
     {
         for ( int i = 0; i < recvMsgSize; i++,bufferptr++ )
@@ -133,29 +524,39 @@ public:
         int nbytesRecvd = 0;
         char *ptr = NULL;
         
-        int datasize = 0;
-        ptr = (char*)&datasize;
+        // protocol version 0 sends only the byte count, and versions before 3 leave out the gravity direction
+        memset( &header, 0, sizeof(header) );
+        int headersize = requestHeaderSize( version );
+        ptr = (char*)&header;
 
         int timeout = 0;
         
-        while ( nbytesRecvd < 4 )
+        while ( nbytesRecvd < headersize )
         {
             int recvMsgSize;
             
             // receive some data
-            recvMsgSize = recv( clntSock, ptr, 4 - nbytesRecvd, 0);
+            recvMsgSize = recv( clntSock, ptr, headersize - nbytesRecvd, 0);
             if ( recvMsgSize < 0 || timeout > 200 ) return false;
             if ( recvMsgSize == 0) timeout++;
             nbytesRecvd += recvMsgSize;
             ptr += recvMsgSize;
         }
         
+        // timings are measured from the arrival of the header, since the client may pause between requests
+        requestStart = Clock::now();
+        memset( &reply, 0, sizeof(reply) );
+        
+        int datasize = header.datasize;
+        
         std::cout << "receiving JPEG image of " << datasize << " bytes\n";
         
-        char *jpegData = new char[datasize];
+        // the receive buffer only grows, so it stops being reallocated once it fits the largest image
+        if ( datasize <= 0 ) return false;
+        jpegData.resize( datasize );
         
         nbytesRecvd = 0;
-        ptr = jpegData;
+        ptr = &jpegData[0];
         timeout = 0;
 
         
@@ -183,10 +584,13 @@ public:
         
 //        membuf mb( jpegData, datasize );
 //        std::istream is( &mb );
-        cv::Mat jpegDataMat( cv::Size(datasize,1), CV_8UC1, jpegData );
-        querycamera->image = cv::imdecode( jpegDataMat, cv::IMREAD_UNCHANGED );
+        reply.receiveTime = secondsSince( requestStart );
         
-        delete [] jpegData;
+        // decode into the existing image, which is reused when the size does not change
+        Clock::time_point decodeStart = Clock::now();
+        cv::Mat jpegDataMat( cv::Size(datasize,1), CV_8UC1, &jpegData[0] );
+        cv::imdecode( jpegDataMat, cv::IMREAD_UNCHANGED, &querycamera->image );
+        reply.decodeTime = secondsSince( decodeStart );
         
         /*
          unsigned char *ptr = querycamera->image.data();
@@ -209,14 +613,17 @@ public:
         return true;
     }
     
-    bool sendPose( Sophus::SE3d &pose )
+    bool sendReply( Sophus::SE3d &pose )
     {
-        double buffer[6];
-        Eigen::Map< Eigen::Matrix<double,6,1> > buffervec(buffer);
-        buffervec = pose.log();
+        Eigen::Map< Eigen::Matrix<double,6,1> > posevec( reply.pose );
+        posevec = pose.log();
+        reply.totalTime = secondsSince( requestStart );
+        
+        // clients before version 2 only understand the pose
+        int replysize = ( version >= 2 ) ? sizeof(reply) : sizeof(double)*6;
         
-        int nbytesSent = send( clntSock, buffer, sizeof(double)*6, 0 );
-        if ( nbytesSent < 0 ) return false;
+        int nbytesSent = send( clntSock, &reply, replysize, 0 );
+        if ( nbytesSent != replysize ) return false;
         
         return true;
     }
@@ -228,20 +635,21 @@ public:
         if ( recv( clntSock, data, 2*sizeof(int), 0 ) != 2*sizeof(int) ) return false;
         
         /*
-         int scale = data[0];
+         int scale = unpackScale( data[0] );
          int shift = data[1];
          */
         
-        int scale = 1;
-        int shift = 0;
-        
-        if ( scale == 2 )
+        version = unpackVersion( data[0] );
+        if ( version > LOCALIZER_PROTOCOL_VERSION )
         {
-            localizer->tracker->firstlevel -= 1;
-            localizer->tracker->lastlevel -= 1;
+            std::cout << "client speaks unknown protocol version " << version << "\n";
+            return false;
         }
-        if ( localizer->tracker->firstlevel < 0 ) localizer->tracker->firstlevel = 0;
-        if ( localizer->tracker->lastlevel < 0 ) localizer->tracker->lastlevel = 0;
+        
+        // the map localizers are shared between connections, so per-connection
+        // image scaling (which would change their tracker levels and threshold) is not supported
+        int scale = 1;
+        int shift = 0;
         
         imsize.width /= scale;
         imsize.height /= scale;
@@ -250,8 +658,6 @@ public:
         querycalibration->focal /= scale;
         querycalibration->center /= scale;
         
-        localizer->thresh /= scale;
-        
         bpp = 8 - shift;
         
         return true;
@@ -268,6 +674,8 @@ public:
                 bool good = waitForImage();
                 if ( !good ) break;
                 
+                Clock::time_point received = Clock::now();
+                
                 //                bool good = true;
                 //                static int mynum = 1;
                 //                stringstream mypath;
@@ -283,39 +691,69 @@ public:
                 //                path << "Output/image" << count++ << ".jpg";
                 //                img_save( querycamera->image, path.str(), ImageType::JPEG );
                 
-                std::vector<Feature*> features;
-                extractSIFT( querycamera->image, features );
+                // requests already running keep the maps they started with
+                updateMaps();
                 
-                for ( int i = 0; i < features.size(); i++ )
+                // a cheap signature of the image finds frames nearly identical to recent ones
+                thumbnails.makeSmallByteImage( querycamera );
+                thumbnails.prepareSmallImage( querycamera );
+                float corr;
+                CachedResult *cached = findCachedResult( corr );
+                
+                Sophus::SE3d pose;
+                bool success = false;
+                if ( cached != NULL && corr >= CACHE_REUSE_CORR )
                 {
-                    std::stringstream name;
-                    name << "feature" << i << "\n";
-                    features[i]->name = name.str();
-                    features[i]->camera = querycamera;
-                    querycamera->features[features[i]->name] = features[i];
+                    // the same view as before: answer with the earlier result without localizing again
+                    pose = cached->pose;
+                    copyStatistics( cached->reply );
+                    reply.matchTime = reply.estimationTime = reply.refinementTime = 0;
+                    success = true;
+                    std::cout << "reusing the result of a near-identical frame (correlation " << corr << ")\n";
                 }
-                
-                querycamera->pyramid.resize( querycamera->image.size() );
-                querycamera->pyramid.copy_from( querycamera->image );
-                
-                
-                bool success = localizer->localize( querycamera );
-                
+                else
+                {
+                    querycamera->pyramid.resize( querycamera->image.size() );
+                    querycamera->pyramid.copy_from( querycamera->image );
+                    
+                    // the budget covers the whole request, so localization gets what is left after the earlier stages
+                    if ( cached != NULL )
+                    {
+                        success = localizeFromCache( cached, received, pose );
+                        std::cout << "tracking from the pose of a similar frame (correlation " << corr << ") " << ( success ? "succeeded" : "failed" ) << "\n";
+                    }
+                    
+                    if ( !success )
+                    {
+                        // the features belong to the store, which reuses them for the next image
+                        Clock::time_point extractStart = Clock::now();
+                        extractSIFT( querycamera->image, featureStore, features );
+                        reply.extractTime = secondsSince( extractStart );
+                        
+                        for ( size_t i = 0; i < features.size(); i++ )
+                        {
+                            features[i]->camera = querycamera;
+                            querycamera->features[features[i]->name] = features[i];
+                        }
+                        
+                        success = localize( received, pose );
+                    }
+                    
+                    if ( success ) addCachedResult( pose );
+                }
+                if ( !success ) std::cout << "localization failed\n";
                 
                 //bool success = false;
                 
-                Sophus::SE3d pose;
-                if ( success ) pose = querynode->pose;
-                
-                good = sendPose( pose );
+                good = sendReply( pose );
                 if ( !good ) break;
                 
                 if ( good ) std::cout << "pose: " << pose.log() << "\n";
+                std::cout << "request took " << reply.totalTime*1000 << " ms (receive " << reply.receiveTime*1000
+                          << ", decode " << reply.decodeTime*1000 << ", extract " << reply.extractTime*1000
+                          << ", match " << reply.matchTime*1000 << ", estimate " << reply.estimationTime*1000
+                          << ", refine " << reply.refinementTime*1000 << ")\n";
                 
-                for ( int i = 0; i < features.size(); i++ )
-                {
-                    delete features[i];
-                }
                 querycamera->features.clear();
             }
         }
@@ -324,8 +762,8 @@ public:
         
         close( clntSock );
         
-        delete localizer;
-        localizer = NULL;
+        deleteQueries();
+        maps.reset();
         
         delete querynode;
         querynode = NULL;
@@ -337,19 +775,34 @@ public:
         querycalibration = NULL;
     }
     
-    Node *root;
+    std::shared_ptr<MapSet> maps;
+    std::vector<ShardQuery*> queries;
+    ShardQuery *localizedIn;    // query of the map the last localization succeeded in
     cv::Size imsize;
     
     Node *querynode;
     Camera *querycamera;
     Calibration *querycalibration;
     
-    NN *index;
-    Localizer *localizer;
-    
     int clntSock;
     char *buffer;
     
+    // per-connection storage reused from one request to the next
+    std::vector<char> jpegData;
+    FeatureStore featureStore;
+    std::vector<Feature*> features;
+    
+    // recent results, oldest first
+    ImageCache thumbnails;
+    std::vector<CachedResult> cache;
+    
+    double time_budget;
+    
+    int version;
+    RequestHeader header;
+    LocalizationReply reply;
+    Clock::time_point requestStart;
+    
     int bpp;
 };
 
@@ -423,28 +876,167 @@ void loadImages( std::string prefix, Node *node )
     }
 }
 
-int main( int argc, char **argv )
+Shard * loadShard( const std::string &pathin, Calibration *calibration, cv::Size imsize )
 {
-    if ( argc != 2 && argc != 3 ) {
-        fprintf( stderr, "usage: %s <reconstruction> [<port>]\n", argv[0] );
-        exit(1);
-    }
-    
-    std::cout << "loading...\n";
+    Shard *shard = new Shard;
+    shard->path = pathin;
     
-    std::string pathin = std::string(argv[1]);
-    int portno = 12345;
-    if ( argc == 3 ) portno = atoi(argv[2]);
-    
-    Reconstruction r;
+    Reconstruction &r = shard->r;
     r.pathPrefix = pathin;
     std::stringstream mypath;
     mypath << pathin << "/reconstruction.xml";
     XML::read( r, mypath.str() );
     
     Node *root = (Node*)r.nodes["root"];
-    loadImages( pathin, root );
+    if ( root == NULL )
+    {
+        std::cerr << "error: could not read reconstruction at " << pathin << "\n";
+        delete shard;
+        return NULL;
+    }
+    std::stringstream atlaspath;
+    atlaspath << pathin << "/atlas.dat";
+    bool have_atlas = shard->atlas.read( atlaspath.str(), r );
+    if ( have_atlas ) std::cout << "read " << shard->atlas.count() << " patches from " << atlaspath.str() << "\n";
+    else if ( imageBudget > 0 ) shard->images = new ImageProvider( pathin, imageBudget );
+    else loadImages( pathin, root );
     XML::readDescriptors( r, root );
+    shard->root = root;
+    
+    shard->index = new BruteForceNN;
+    
+    NNLocalizer *localizer = new NNLocalizer( root, shard->index );
+    localizer->verbose = true;
+    //        localizer->tracker->firstlevel = 3;
+    //        localizer->tracker->lastlevel = 1;
+    localizer->tracker->minnumpoints = 200;
+    if ( have_atlas ) localizer->tracker->atlas = &shard->atlas;
+    localizer->tracker->images = shard->images;
+    localizer->thresh = 0.006 * imsize.width / calibration->focal;
+    //        localizer->thresh *= 2.;
+    shard->localizer = localizer;
+    
+    // bounds of the camera centers, for routing location hints
+    shard->georegistered = ( r.utmZone != 0 );
+    shard->gravityAligned = ( r.upright || shard->georegistered );
+    shard->minEast = shard->minNorth = INFINITY;
+    shard->maxEast = shard->maxNorth = -INFINITY;
+    ElementList::iterator it;
+    for ( it = root->children.begin(); it != root->children.end(); it++ )
+    {
+        Node *node = (Node *)it->second;
+        Sophus::SE3d pose = node->globalPose();
+        Eigen::Vector3d center = -( pose.so3().inverse() * pose.translation() );
+        double east = center[0] + r.utmCenterEast;
+        double north = center[2] + r.utmCenterNorth;
+        shard->minEast = std::min( shard->minEast, east );
+        shard->maxEast = std::max( shard->maxEast, east );
+        shard->minNorth = std::min( shard->minNorth, north );
+        shard->maxNorth = std::max( shard->maxNorth, north );
+    }
+    if ( root->children.empty() ) shard->georegistered = false;
+    
+    shard->offset = Eigen::Vector3d::Zero();
+    
+    return shard;
+}
+
+/**
+ * Loads one shard per reconstruction in a comma-separated list.
+ * Returns NULL if any of them fails to load.
+ */
+MapSet * loadMaps( const std::string &pathsin, Calibration *calibration, cv::Size imsize )
+{
+    MapSet *maps = new MapSet;
+    std::vector<Shard*> &shards = maps->shards;
+    
+    std::stringstream pathstream( pathsin );
+    std::string pathin;
+    while ( std::getline( pathstream, pathin, ',' ) )
+    {
+        if ( pathin.empty() ) continue;
+        Shard *shard = loadShard( pathin, calibration, imsize );
+        if ( shard == NULL )
+        {
+            delete maps;
+            return NULL;
+        }
+        shards.push_back( shard );
+    }
+    if ( shards.empty() )
+    {
+        std::cerr << "error: no reconstructions given\n";
+        delete maps;
+        return NULL;
+    }
+    
+    // poses are returned in the frame of the first map; geo-registered maps in the same UTM zone are translated into it
+    Reconstruction &ref = shards[0]->r;
+    for ( size_t i = 1; i < shards.size(); i++ )
+    {
+        Reconstruction &r = shards[i]->r;
+        if ( ref.utmZone == 0 || r.utmZone != ref.utmZone || r.utmNorth != ref.utmNorth ) continue;
+        shards[i]->offset = Eigen::Vector3d( ref.utmCenterEast - r.utmCenterEast, 0, ref.utmCenterNorth - r.utmCenterNorth );
+    }
+    
+    return maps;
+}
+
+// written to by the SIGHUP handler to wake the reload thread
+static int reloadPipe[2];
+
+static void handleReloadSignal( int sig )
+{
+    char c = 0;
+    if ( write( reloadPipe[1], &c, 1 ) < 0 ) {
+        // a reload is already pending
+    }
+}
+
+/**
+ * Reloads the maps from disk each time the server receives SIGHUP.
+ * The new maps are loaded in the background while the old ones keep serving, then swapped in.
+ */
+void reloadMaps( std::string pathsin, Calibration *calibration, cv::Size imsize )
+{
+    for ( ; ; )
+    {
+        char c;
+        ssize_t nread = read( reloadPipe[0], &c, 1 );
+        if ( nread < 0 && errno == EINTR ) continue;
+        if ( nread <= 0 ) return;
+        
+        std::cout << "reloading maps...\n";
+        
+        MapSet *maps = loadMaps( pathsin, calibration, imsize );
+        if ( maps == NULL )
+        {
+            std::cout << "reload failed; still serving the old maps\n";
+            continue;
+        }
+        
+        maps->generation = std::atomic_load( &currentMaps )->generation + 1;
+        std::atomic_store( &currentMaps, std::shared_ptr<MapSet>( maps ) );
+        
+        std::cout << "now serving map generation " << maps->generation << "\n";
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 || argc > 5 ) {
+        fprintf( stderr, "usage: %s <reconstruction>[,<reconstruction>...] [<port>] [<time budget in ms>] [<image memory per map in MB>]\n", argv[0] );
+        exit(1);
+    }
+    
+    std::cout << "loading...\n";
+    
+    std::string pathsin = std::string(argv[1]);
+    int portno = 12345;
+    if ( argc >= 3 ) portno = atoi(argv[2]);
+    double time_budget = 0;
+    if ( argc >= 4 ) time_budget = atof(argv[3]) / 1000.;
+    if ( argc >= 5 ) imageBudget = (size_t)( atof(argv[4]) * 1048576. );
     
     Calibration *calibration = new Calibration;
     cv::Size imsize;
@@ -463,24 +1055,32 @@ int main( int argc, char **argv )
     //    calibration->focal *= levelScale;
     //    calibration->center *= levelScale;
     
+    // one shard per reconstruction; all connections share them
+    MapSet *maps = loadMaps( pathsin, calibration, imsize );
+    if ( maps == NULL ) exit(1);
+    std::atomic_store( &currentMaps, std::shared_ptr<MapSet>( maps ) );
+    
+    // send SIGHUP to reload the maps without dropping connections
+    if ( pipe( reloadPipe ) != 0 ) DieWithError( "pipe() failed" );
+    std::thread reloadThread( reloadMaps, pathsin, calibration, imsize );
+    reloadThread.detach();
+    signal( SIGHUP, handleReloadSignal );
+    
     int servSock = CreateTCPServerSocket(portno);
     
     std::cout << "server ready.\n";
     
-#if USE_DISPATCH
-    dispatch_queue_t myCustomQueue = dispatch_queue_create("com.example.MyCustomQueue", NULL);
-#endif
-    
     for ( ; ; )
     {
         int clntSock = AcceptTCPConnection(servSock);
         
-#if USE_DISPATCH
-        dispatch_async(myCustomQueue, ^{
-            ServerThread *serverThread = new ServerThread( root, calibration, imsize, clntSock );
+        // connections spend most of their time blocked on the socket, so each gets its own thread rather than a pool task
+        std::thread connectionThread( [=]{
+            ServerThread *serverThread = new ServerThread( calibration, imsize, clntSock, time_budget );
             serverThread->run();
-        });
-#endif
+            delete serverThread;
+        } );
+        connectionThread.detach();
     }
     
     return 0;
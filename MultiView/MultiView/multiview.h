@@ -296,6 +296,7 @@ namespace vrlt {
     void transformPoints( Node *node, Sophus::SE3d &pose );
     void transformPoints( Node *node, Sophus::Sim3d &transform );
     void removeCameraFeatures( Reconstruction &r, Camera *camera );
+    void clearReconstruction( Reconstruction &r );
     Camera * addCameraToReconstruction( Reconstruction &r, const Calibration *_calibration, const cv::Mat &image, const Sophus::SE3d &pose );
     cv::Vec3b getColorSubpix(const cv::Mat& img, cv::Point2f pt);
     uchar getGraySubpix(const cv::Mat& img, cv::Point2f pt);
@@ -325,6 +326,14 @@ namespace vrlt {
     }
     
     void getGluLookAtVectors( const Sophus::SE3d &pose, Eigen::Vector3d &eye, Eigen::Vector3d &center, Eigen::Vector3d &up );
+    
+    /**
+     * \brief Returns the direction of gravity in the camera frame (x right, y down, z forward) from a device attitude.
+     *
+     * The attitude rotates reference coordinates into device coordinates, with the reference z axis pointing up as
+     * Core Motion reports it, and imuToCamera changes device axes into camera axes.
+     */
+    Eigen::Vector3d attitudeToDown( const Sophus::SO3d &attitude, const Sophus::SO3d &imuToCamera );
 
     /** @}
      */
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: parallel.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup MultiView
+ * @{
+ */
+
+    class TaskGroup;
+
+    /** \brief A unit of work queued on a ThreadPool. */
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup *group;
+    };
+
+    /**
+     * \brief Work-stealing thread pool.
+     *
+     * Each worker keeps its own queue of tasks, takes new work from its back and, when it runs out, steals from the
+     * front of the other queues.  Threads outside the pool queue their tasks on a shared queue.  Threads waiting for
+     * a group of tasks to finish run queued tasks of that group in the meantime, so parallel loops may be nested.
+     */
+    class ThreadPool
+    {
+    public:
+        /** Creates a pool with nthreads workers, or one fewer than the number of hardware threads if nthreads is zero. */
+        ThreadPool( int nthreads = 0 );
+        ~ThreadPool();
+
+        /** Returns the pool shared by the library, created on first use. */
+        static ThreadPool & instance();
+
+        /** Number of worker threads; the calling thread also runs tasks while it waits. */
+        int size() const { return (int)workers.size(); }
+
+        /** Queues a task. */
+        void push( Task *task );
+
+        /** Runs one queued task of group, or of any group if it is NULL.  \return False if no such task was queued. */
+        bool runOne( TaskGroup *group = NULL );
+
+    protected:
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex mutex;
+            std::deque<Task*> tasks;
+        };
+
+        Task * take( int index, TaskGroup *group = NULL );
+        static void runTask( Task *task );
+        void workerLoop( int index );
+
+        std::vector<Worker*> workers;
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Task*> shared;       // tasks queued by threads outside the pool
+        std::atomic<int> pending;       // number of queued tasks
+        bool stopping;
+    };
+
+    /**
+     * \brief A set of tasks which can be waited on together.
+     *
+     * The destructor waits for any tasks still running.
+     */
+    class TaskGroup
+    {
+    public:
+        TaskGroup( ThreadPool &_pool = ThreadPool::instance() );
+        ~TaskGroup();
+
+        /** Queues fn to run on the pool. */
+        void run( const std::function<void()> &fn );
+
+        /**
+         * \brief Waits for all tasks of the group to finish, running its queued tasks in the meantime.
+         *
+         * Tasks of other groups are left alone, so the caller may hold a lock which those tasks take.
+         */
+        void wait();
+
+    protected:
+        friend class ThreadPool;
+
+        ThreadPool &pool;
+        std::atomic<int> remaining;
+        std::mutex mutex;
+        std::condition_variable cond;   // signalled when the last task finishes
+    };
+
+    /**
+     * \brief Calls fn( context, i ) for i from 0 to count-1 on the shared pool and waits for all calls to return.
+     *
+     * The range is split in halves down to chunks of grain indices, which idle threads steal.  With a grain of zero
+     * the chunk size is chosen from count and the number of threads.  Ranges no longer than grain run serially on the
+     * calling thread, so a grain larger than one avoids the overhead of tasks for short loops.
+     */
+    void parallel_for( size_t count, void *context, void (*fn)( void *context, size_t i ), size_t grain = 0 );
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -308,6 +308,39 @@ namespace vrlt
         camera->features.clear();
     }
     
+    static void deleteNode( Node *node )
+    {
+        ElementList::iterator it;
+        for ( it = node->points.begin(); it != node->points.end(); it++ ) delete (Point*)it->second;
+        for ( it = node->planes.begin(); it != node->planes.end(); it++ ) delete (Plane*)it->second;
+        for ( it = node->children.begin(); it != node->children.end(); it++ ) deleteNode( (Node*)it->second );
+        delete node;
+    }
+    
+    void clearReconstruction( Reconstruction &r )
+    {
+        ElementList::iterator it;
+        
+        // delete through the concrete types, since Element has no virtual destructor
+        for ( it = r.calibrations.begin(); it != r.calibrations.end(); it++ ) delete (Calibration*)it->second;
+        for ( it = r.cameras.begin(); it != r.cameras.end(); it++ ) delete (Camera*)it->second;
+        for ( it = r.features.begin(); it != r.features.end(); it++ ) delete (Feature*)it->second;
+        for ( it = r.matches.begin(); it != r.matches.end(); it++ ) delete (Match*)it->second;
+        for ( it = r.triplets.begin(); it != r.triplets.end(); it++ ) delete it->second;
+        for ( it = r.pairs.begin(); it != r.pairs.end(); it++ ) delete (Pair*)it->second;
+        for ( it = r.tracks.begin(); it != r.tracks.end(); it++ ) delete (Track*)it->second;
+        for ( it = r.nodes.begin(); it != r.nodes.end(); it++ ) deleteNode( (Node*)it->second );
+        
+        r.calibrations.clear();
+        r.cameras.clear();
+        r.features.clear();
+        r.matches.clear();
+        r.triplets.clear();
+        r.pairs.clear();
+        r.tracks.clear();
+        r.nodes.clear();
+    }
+    
     Camera * addCameraToReconstruction( Reconstruction &r, const Calibration *_calibration, const cv::Mat &image, const Sophus::SE3d &pose )
     {
         char name[1024];
@@ -430,4 +463,10 @@ namespace vrlt
         // up is up vector of camera
         up = pose.so3().inverse() * makeVector( 0., -1., 0. );
     }
+    
+    Eigen::Vector3d attitudeToDown( const Sophus::SO3d &attitude, const Sophus::SO3d &imuToCamera )
+    {
+        // down in the reference frame, rotated into device and then camera axes
+        return imuToCamera * ( attitude * makeVector( 0., 0., -1. ) );
+    }
 }
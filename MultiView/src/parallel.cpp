@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: parallel.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <MultiView/parallel.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace vrlt
+{
+    // the pool and worker index of the calling thread, if it is a worker
+    static thread_local ThreadPool *currentPool = NULL;
+    static thread_local int currentWorker = -1;
+
+    ThreadPool::ThreadPool( int nthreads )
+    : pending( 0 ), stopping( false )
+    {
+        if ( nthreads <= 0 ) nthreads = std::max( 1, (int)std::thread::hardware_concurrency() - 1 );
+
+        for ( int i = 0; i < nthreads; i++ ) workers.push_back( new Worker );
+        for ( int i = 0; i < nthreads; i++ ) workers[i]->thread = std::thread( &ThreadPool::workerLoop, this, i );
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+        cond.notify_all();
+
+        for ( size_t i = 0; i < workers.size(); i++ )
+        {
+            workers[i]->thread.join();
+            delete workers[i];
+        }
+    }
+
+    ThreadPool & ThreadPool::instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::push( Task *task )
+    {
+        if ( currentPool == this )
+        {
+            Worker *worker = workers[currentWorker];
+            std::lock_guard<std::mutex> lock( worker->mutex );
+            worker->tasks.push_back( task );
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            shared.push_back( task );
+        }
+
+        pending++;
+        {
+            // a worker about to sleep checks pending under this lock, so it cannot miss the notification
+            std::lock_guard<std::mutex> lock( mutex );
+        }
+        cond.notify_one();
+    }
+
+    // removes the newest or oldest task of the queue, only among the tasks of group if it is not NULL
+    static Task * removeTask( std::deque<Task*> &tasks, TaskGroup *group, bool newest )
+    {
+        for ( size_t i = 0; i < tasks.size(); i++ )
+        {
+            size_t j = ( newest ) ? tasks.size() - 1 - i : i;
+            if ( group != NULL && tasks[j]->group != group ) continue;
+            Task *task = tasks[j];
+            tasks.erase( tasks.begin() + j );
+            return task;
+        }
+        return NULL;
+    }
+
+    Task * ThreadPool::take( int index, TaskGroup *group )
+    {
+        if ( pending == 0 ) return NULL;
+
+        Task *task = NULL;
+
+        // newest task of our own queue, which is most likely to still be in cache
+        if ( index >= 0 )
+        {
+            Worker *worker = workers[index];
+            std::lock_guard<std::mutex> lock( worker->mutex );
+            task = removeTask( worker->tasks, group, true );
+        }
+
+        if ( task == NULL )
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            task = removeTask( shared, group, false );
+        }
+
+        // steal the oldest task of another worker, which usually covers the largest range
+        for ( size_t i = 1; task == NULL && i <= workers.size(); i++ )
+        {
+            Worker *victim = workers[( index + i ) % workers.size()];
+            std::lock_guard<std::mutex> lock( victim->mutex );
+            task = removeTask( victim->tasks, group, false );
+        }
+
+        if ( task != NULL ) pending--;
+        return task;
+    }
+
+    void ThreadPool::runTask( Task *task )
+    {
+        task->fn();
+        
+        // decrement under the lock, so that a waiting thread cannot destroy the group while it is being signalled
+        TaskGroup *group = task->group;
+        delete task;
+        std::lock_guard<std::mutex> lock( group->mutex );
+        if ( --group->remaining == 0 ) group->cond.notify_all();
+    }
+
+    bool ThreadPool::runOne( TaskGroup *group )
+    {
+        Task *task = take( ( currentPool == this ) ? currentWorker : -1, group );
+        if ( task == NULL ) return false;
+        runTask( task );
+        return true;
+    }
+
+    void ThreadPool::workerLoop( int index )
+    {
+        currentPool = this;
+        currentWorker = index;
+
+        for ( ; ; )
+        {
+            Task *task = take( index );
+            if ( task != NULL )
+            {
+                runTask( task );
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( mutex );
+            cond.wait( lock, [this]{ return stopping || pending > 0; } );
+            if ( stopping ) break;
+        }
+    }
+
+    TaskGroup::TaskGroup( ThreadPool &_pool )
+    : pool( _pool ), remaining( 0 )
+    {
+
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        wait();
+    }
+
+    void TaskGroup::run( const std::function<void()> &fn )
+    {
+        Task *task = new Task;
+        task->fn = fn;
+        task->group = this;
+        remaining++;
+        pool.push( task );
+    }
+
+    void TaskGroup::wait()
+    {
+        while ( remaining > 0 )
+        {
+            // help only with our own tasks: an unrelated task could need a lock the caller holds, or wait on a
+            // task queued behind us
+            if ( pool.runOne( this ) ) continue;
+            
+            // the tasks left are running on other threads; check back now and then for new tasks to help with
+            std::unique_lock<std::mutex> lock( mutex );
+            cond.wait_for( lock, std::chrono::microseconds( 100 ), [this]{ return remaining == 0; } );
+        }
+        
+        // the last task may still hold the lock
+        std::lock_guard<std::mutex> lock( mutex );
+    }
+
+    static void runRange( TaskGroup *group, void *context, void (*fn)( void *context, size_t i ), size_t begin, size_t end, size_t grain )
+    {
+        // hand the upper halves to other threads and keep the lower half
+        while ( end - begin > grain )
+        {
+            size_t mid = begin + ( end - begin ) / 2;
+            group->run( [=]{ runRange( group, context, fn, mid, end, grain ); } );
+            end = mid;
+        }
+
+        for ( size_t i = begin; i < end; i++ ) fn( context, i );
+    }
+
+    void parallel_for( size_t count, void *context, void (*fn)( void *context, size_t i ), size_t grain )
+    {
+        if ( count == 0 ) return;
+
+        ThreadPool &pool = ThreadPool::instance();
+
+        // about four chunks per thread leaves room to balance uneven work
+        if ( grain == 0 ) grain = std::max( (size_t)1, count / ( 4 * ( pool.size() + 1 ) ) );
+
+        if ( count <= grain )
+        {
+            for ( size_t i = 0; i < count; i++ ) fn( context, i );
+            return;
+        }
+
+        TaskGroup group( pool );
+        runRange( &group, context, fn, 0, count, grain );
+        group.wait();
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: imageprovider.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef IMAGEPROVIDER_H
+#define IMAGEPROVIDER_H
+
+#include <MultiView/multiview.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Loads camera images and pyramids on demand, keeping the recently used ones within a memory budget.
+     *
+     * The images and pyramids of the cameras are set when they are required and cleared again when they are
+     * evicted, so the tracker sees a camera's pyramid as usual while it is resident.  All changes to the cameras
+     * happen in require(), on the calling thread; a background thread only decodes the images queued by prefetch().
+     * Prefetched images count against the budget once require() takes them in.  Cameras which already have an image
+     * when they are first required, such as new keyframes, are left alone.  A camera whose image cannot be read is
+     * reported once and not tried again.
+     */
+    class ImageProvider
+    {
+    public:
+        /** Images are read from prefix/camera->path. */
+        ImageProvider( const std::string &_prefix, size_t _maxBytes );
+        ~ImageProvider();
+        
+        /** Makes the pyramids of the cameras resident, loading those which are not, then evicts least recently used pyramids of other cameras down to the budget. */
+        void require( const std::vector<Camera*> &cameras );
+        
+        /** Queues the cameras which are not resident for loading in the background, replacing the cameras queued before. */
+        void prefetch( const std::vector<Camera*> &cameras );
+        
+        /** Whether the camera's pyramid is loaded. */
+        bool resident( Camera *camera ) const { return ( residents.find( camera ) != residents.end() ); }
+        
+        size_t residentBytes() const { return nbytes; }
+        
+        int nhits;              // cameras required which were resident
+        int nprefetched;        // cameras required which the background thread had loaded
+        int nmisses;            // cameras required which had to be loaded on the spot
+        
+    protected:
+        struct Resident
+        {
+            size_t bytes;
+            size_t lastUsed;    // number of the require() call which last used the pyramid
+            bool prefetched;    // loaded in the background and not required since
+        };
+        
+        bool load( Camera *camera, ImagePyramid &pyramid );
+        void install( Camera *camera, const ImagePyramid &pyramid, bool prefetched );
+        void installReady();
+        void evict( Camera *camera );
+        void loaderLoop();
+        
+        std::string prefix;
+        size_t maxBytes;
+        size_t nbytes;
+        size_t frame;
+        std::map<Camera*,Resident> residents;
+        
+        // shared with the loader thread
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Camera*> pending;
+        std::vector< std::pair<Camera*,ImagePyramid> > ready;
+        Camera *loading;
+        std::set<Camera*> failed;           // cameras whose image could not be read
+        bool stopping;
+        std::thread loader;
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: localmapper.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef LOCALMAPPER_H
+#define LOCALMAPPER_H
+
+#include <MultiView/multiview.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    class Tracker;
+
+    /**
+     * \brief Builds new keyframes in the background and hands them to the tracker between frames.
+     *
+     * submit() takes a tracked frame as a keyframe candidate and only records its image, pose and the points tracked
+     * in it.  A background thread then makes the camera, its node, its image pyramid and a feature for each tracked
+     * point, without touching the reconstruction or the tracker.  Finished keyframes are published to a second
+     * buffer, which apply() swaps out on the tracking thread and links into the reconstruction, the tracks of the
+     * points and the tracker's source cameras.  The tracking thread thus never waits for a keyframe to be built, and
+     * the map is only changed between calls to Tracker::track().
+     *
+     * The keyframes add new views of points already in the map, as addCameraToReconstruction() does; no new points
+     * are triangulated.
+     */
+    class LocalMapper
+    {
+    public:
+        LocalMapper();
+
+        /** Deletes keyframes which were built but never applied. */
+        ~LocalMapper();
+
+        /**
+         * \brief Queues the frame just tracked as a new keyframe.
+         *
+         * The image is shared rather than copied, so it must not be written to afterwards; pass a clone if its
+         * buffer is reused for the next frame.  The points tracked in the frame are read from the tracker.
+         * \return False if a keyframe is still being built, in which case the candidate is dropped: the keyframe
+         * selection cannot see that keyframe until it is applied.
+         */
+        bool submit( const Camera *camera, const cv::Mat &image, const Tracker &tracker );
+
+        /** Links the keyframes finished since the last call into the reconstruction and the tracker.  \return The number of keyframes added. */
+        int apply( Reconstruction &r, Tracker &tracker );
+
+        /** Whether a submitted keyframe has not been applied yet. */
+        bool busy();
+
+        int nsubmitted;         // candidates accepted by submit()
+        int ndropped;           // candidates dropped because a keyframe was being built
+        int nadded;             // keyframes added by apply()
+
+    protected:
+        struct Candidate
+        {
+            cv::Mat image;
+            Sophus::SE3d pose;
+            const Calibration *calibration;
+            std::vector< std::pair<Point*,Eigen::Vector2f> > observations;
+        };
+
+        struct Keyframe
+        {
+            Camera *camera;
+            const Calibration *calibration;
+            std::vector< std::pair<Point*,Feature*> > features;
+        };
+
+        static Keyframe * build( const Candidate &candidate );
+        static void destroy( Keyframe *keyframe );
+        void mapperLoop();
+
+        // shared with the mapping thread
+        std::mutex mutex;
+        std::condition_variable cond;
+        Candidate *pending;
+        bool building;
+        std::vector<Keyframe*> ready;       // back buffer, swapped out by apply()
+        bool stopping;
+        std::thread mapper;
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: motionmodel.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef MOTIONMODEL_H
+#define MOTIONMODEL_H
+
+#include <MultiView/multiview.h>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Predicts the pose of the next frame for the tracker.
+     *
+     * The rotation since the last tracked frame comes from the change of device attitude when both frames have one,
+     * or else from integrating the gyro rotation rate over the frame interval.  Without either, and for the
+     * translation, the velocity between the last two tracked frames is extrapolated, damped.
+     *
+     * Attitudes and rotation rates are in device axes and are conjugated by imuToCamera; as elsewhere in vrlt, the
+     * attitude rotates reference coordinates into device coordinates, so the change from frame a to frame b
+     * pre-multiplies the world-to-camera pose by A_b A_a^-1.
+     */
+    class MotionModel
+    {
+    public:
+        MotionModel();
+        
+        Sophus::SO3d imuToCamera;       // change of axes from the device to the camera
+        double damping;                 // fraction of the last velocity assumed to carry over
+        double errorMargin;             // multiple of the recent prediction error allowed for
+        
+        /** Forgets the tracked poses, e.g. after the camera was relocalized. */
+        void reset();
+        
+        /** Whether a pose has been tracked since the last reset(). */
+        bool hasPose() const { return have_pose; }
+        
+        /** Predicts the pose of the camera from its timestamp, attitude and rotation rate. */
+        Sophus::SE3d predict( const Camera *camera );
+        
+        /** Records the tracked pose of the camera last passed to predict(). */
+        void update( const Camera *camera, const Sophus::SE3d &pose );
+        
+        /**
+         * \brief Expected image error of the last prediction in pixels, or infinity until it can be estimated.
+         *
+         * Only the rotation error of recent predictions is covered.  The image error of a translation error depends on
+         * the depth of the points, which the model does not know, so fast motion close to the scene can exceed this
+         * estimate; errorMargin leaves room for it.
+         */
+        double expectedError( double focal ) const;
+        
+        /** Returns the finest pyramid level between lastlevel and maxlevel whose search window covers expectedError(), which ignores translation error. */
+        int firstLevel( double focal, int lastlevel, int maxlevel ) const;
+        
+    protected:
+        bool have_pose;
+        bool have_velocity;
+        bool have_error;
+        
+        Sophus::SE3d last_pose;
+        Sophus::SO3d last_attitude;
+        double last_time;
+        Eigen::Matrix<double,6,1> velocity;     // per second, or per frame without timestamps
+        
+        Sophus::SE3d predicted;
+        double error;                           // recent rotation error of the predictions, in radians
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -25,6 +25,28 @@ namespace vrlt {
     unsigned int computeSumSq( unsigned char *x, int rowstep );
     unsigned int computeDotProduct( unsigned char *x, int rowstep, unsigned char *y );
 
+    /**
+     * Computes the sum, sum of squares and dot product with the template y of each of the 64 8x8 windows in the 15x15
+     * region at x, reading 16 bytes of each of its rows.  Results for the window at offset (dx,dy) are at index 8*dy+dx,
+     * and equal those of the functions above.
+     */
+    void computeWindowStatistics( unsigned char *x, int rowstep, unsigned char *y, unsigned int *sums, unsigned int *sumsqs, unsigned int *dots );
+
+    /** Implementations of the 8x8 primitives: NEON is chosen when compiling, and the fastest of the others the CPU supports at run time. */
+    enum NCCKernel
+    {
+        NCCKernelScalar,
+        NCCKernelSSE41,
+        NCCKernelAVX2,
+        NCCKernelNEON
+    };
+    
+    /** Returns the implementation in use. */
+    NCCKernel getNCCKernel();
+    
+    /** Switches to another implementation, e.g. to compare them.  Not thread safe.  \return False if the CPU does not support it. */
+    bool setNCCKernel( NCCKernel kernel );
+
 /**
  * @}
  */
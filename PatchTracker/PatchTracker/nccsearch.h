@@ -33,6 +33,14 @@ namespace vrlt
         uchar *targets;
         float *templateA;
         float *templateC;
+        float *templateJacobians;   // gradients of the inner 6x6 pixels of each template, x then y
+        float *templateHessians;    // inverse of the 2x2 Gauss-Newton matrix of each template, as (xx, xy, yy)
+        
+        bool refine;            // refine the best integer offset to sub-pixel precision
+        
+        // a patch reuses its template from an earlier frame while the template corners move less than this in the source image
+        float templateReuseThreshold;
+        int nreused;            // templates reused by the last makeTemplates()
     };
     
 /**
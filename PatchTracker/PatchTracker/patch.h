@@ -22,12 +22,31 @@ namespace vrlt
  * \addtogroup PatchTracker
  * @{
  */
+
+    /** \brief An NCC template kept from an earlier frame, with the statistics computed from it. */
+    struct CachedTemplate
+    {
+        Camera *source;         // camera and pyramid level the template was sampled from
+        int sourceLevel;
+        Eigen::Matrix3f M;      // warp from template to source image used to sample it
+        uchar patch[64];
+        float A;
+        float C;
+        float J[2*6*6];         // gradients of the inner 6x6 pixels for sub-pixel refinement
+        float Hinv[3];          // inverse of their Gauss-Newton Hessian
+    };
+    
     class Patch
     {
     public:
         Sampler sampler;
 
         Patch( Point *_point );
+        ~Patch();
+        
+        // the patch owns its cache, so it is not copied
+        Patch( const Patch & ) = delete;
+        Patch & operator=( const Patch & ) = delete;
         
         void setTarget( Camera *camera );
 
@@ -44,6 +63,8 @@ namespace vrlt
         bool shouldTrack;
         int bestLevel;
         size_t index;
+        size_t storeIndex;      // index of the point in Tracker::pointStore
+        CachedTemplate *cache;  // one template per tracker pyramid level, allocated when the patch is first searched
         
         // best search location in target image
         Eigen::Vector2f targetPos;
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: patchatlas.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef PATCHATLAS_H
+#define PATCHATLAS_H
+
+#include <MultiView/multiview.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Image patches around every feature of the map points, in place of the full keyframe images.
+     *
+     * Each feature of a point's track keeps a square patch at every pyramid level, centered on the feature.  The tracker
+     * samples its templates from these patches when Tracker::atlas is set, so the keyframe images need not be loaded.
+     * Atlases are made offline with MakePatchAtlas and stored as one binary file.
+     */
+    class PatchAtlas
+    {
+    public:
+        struct Entry
+        {
+            cv::Mat levels[NLEVELS];        // patches, which point into the atlas pixels
+            cv::Point2i origins[NLEVELS];   // position of each patch in its pyramid level
+        };
+        
+        PatchAtlas();
+        
+        /** Width and height of the patches in pixels. */
+        int size() const { return patchSize; }
+        
+        /** Number of features with a patch. */
+        size_t count() const { return features.size(); }
+        
+        /**
+         * \brief Cuts the patches of the features of all points of root from their cameras' pyramids.
+         *
+         * The pyramids of the cameras must be loaded.
+         */
+        void make( Node *root, int size = 16 );
+        
+        bool write( const std::string &path ) const;
+        
+        /** Reads an atlas and binds its patches to the features of r.  \return False if the file cannot be read. */
+        bool read( const std::string &path, Reconstruction &r );
+        
+        /** Returns the patches of the feature, or NULL if the atlas has none. */
+        const Entry * find( const Feature *feature ) const;
+        
+    protected:
+        void allocate( size_t n );
+        
+        int patchSize;
+        std::vector<const Feature*> features;
+        std::vector<Entry> entries;
+        std::vector<unsigned char> pixels;
+        std::unordered_map<const Feature*,size_t> lookup;
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: patchbudget.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef PATCHBUDGET_H
+#define PATCHBUDGET_H
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Chooses how many patches the tracker can afford to search within a frame-time target.
+     *
+     * The cost of a frame is modelled as a fixed part, for culling and source selection, plus a cost per patch and
+     * pyramid level searched.  Both are measured on each frame and smoothed, so the budget follows the hardware and
+     * the scene.
+     */
+    class PatchBudget
+    {
+    public:
+        PatchBudget();
+        
+        double frameTime;       // target duration of Tracker::track() in seconds; zero leaves the patch count and levels as they are
+        int minPatches;         // fewest patches worth searching; coarse levels are skipped before the count drops below this
+        double smoothing;       // weight of the newest measurement in the running costs
+        
+        /** Forgets the measured costs. */
+        void reset();
+        
+        /**
+         * \brief Plans the next frame.
+         * \param maxpatches Most patches that may be searched.
+         * \param firstlevel Coarsest pyramid level requested.
+         * \param lastlevel Finest pyramid level searched.
+         * \param npatches Receives the number of patches to search.
+         * \param startlevel Receives the pyramid level to start at, between lastlevel and firstlevel.
+         */
+        void plan( int maxpatches, int firstlevel, int lastlevel, int &npatches, int &startlevel ) const;
+        
+        /** Records the time spent on a frame before searching any patch. */
+        void recordFixed( double seconds );
+        
+        /** Records the time spent making templates for and searching count patches at one level. */
+        void recordLevel( int count, double seconds );
+        
+    protected:
+        bool have_fixed;
+        bool have_patch;
+        double fixedCost;       // seconds per frame
+        double patchCost;       // seconds per patch and level
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: pointgrid.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef POINTGRID_H
+#define POINTGRID_H
+
+#include <Eigen/Core>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Uniform grid over map point positions for frustum culling.
+     *
+     * Each occupied cell keeps the bounding box of its points, so whole cells outside the view can be rejected with a
+     * few plane tests instead of projecting every point.  Points at infinity or with a negative homogeneous
+     * coordinate are not binned and are always returned.
+     */
+    class PointGrid
+    {
+    public:
+        /** Bins the points; the indices returned by cull() refer to this vector. */
+        void build( const std::vector<Eigen::Vector4d> &positions );
+        
+        /**
+         * \brief Finds the points which may project into an image of the given size.
+         *
+         * The pose matrix [R|t] maps world points to the camera and (f,u,v) are the pinhole parameters, as in
+         * Tracker::poseMatrix.  The test is conservative: every point in front of the camera which projects inside
+         * the image is returned, plus some which do not.
+         * \param indices Receives the point indices in increasing order.
+         */
+        void cull( const Eigen::Matrix<float,3,4> &poseMatrix, float f, float u, float v, const cv::Size &size, std::vector<size_t> &indices ) const;
+        
+        size_t numCells() const { return cells.size(); }
+        
+    protected:
+        struct Cell
+        {
+            Eigen::Vector3d lower, upper;   // bounds of the points in the cell
+            size_t begin, end;              // range of pointIndices
+        };
+        
+        std::vector<Cell> cells;            // occupied cells only
+        std::vector<size_t> pointIndices;   // grouped by cell
+        std::vector<size_t> unbinned;
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: pointstore.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef POINTSTORE_H
+#define POINTSTORE_H
+
+#include <MultiView/multiview.h>
+
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Packed copy of the map points used by the tracker, with one array per coordinate.
+     *
+     * Positions and normals are copied when the store is built.  Tracker::track() writes the tracked flags and
+     * measured locations of the points it tracks, so that the per-frame loops read a few contiguous arrays instead
+     * of following Point pointers through the map.
+     */
+    struct PointStore
+    {
+        std::vector<Point*> points;
+        std::vector<float> x, y, z, w;          // homogeneous positions
+        std::vector<float> nx, ny, nz;          // normals
+        std::vector<unsigned char> tracked;
+        std::vector<float> u, v;                // measured locations of tracked points
+        std::vector<size_t> trackedIndices;     // points marked tracked since the last clearTracked()
+        
+        /** Copies the positions and normals of the points. */
+        void build( const std::vector<Point*> &_points );
+        
+        size_t size() const { return points.size(); }
+        
+        /** Clears the tracked flags set since the last call. */
+        void clearTracked();
+        
+        void setTracked( size_t i );
+        void setLocation( size_t i, const Eigen::Vector2f &location ) { u[i] = location[0]; v[i] = location[1]; }
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: profiler.h
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <PatchTracker/timer.h>
+
+#include <string>
+#include <vector>
+
+namespace vrlt
+{
+
+/**
+ * \addtogroup PatchTracker
+ * @{
+ */
+
+    /**
+     * \brief Records the time spent in each stage of tracking, per frame and pyramid level.
+     *
+     * Stages are timed with Scope objects, and nothing is recorded unless enabled is set.  The events can be written
+     * as CSV, or in the Chrome trace event format which chrome://tracing and Perfetto show as a timeline.
+     */
+    class Profiler
+    {
+    public:
+        struct Event
+        {
+            const char *stage;      // name of the stage; must be a string literal
+            int frame;
+            int level;              // pyramid level, or -1 for stages covering all levels
+            int count;              // number of points or patches processed
+            uint64_t start;         // ns since the profiler was created
+            uint64_t duration;      // ns
+        };
+        
+        /** Times a stage from construction to destruction. */
+        class Scope
+        {
+        public:
+            Scope( Profiler &_profiler, const char *_stage, int _level = -1, int _count = 0 );
+            ~Scope();
+            
+            int count;              // may be set before the scope ends
+            
+        protected:
+            Profiler &profiler;
+            const char *stage;
+            int level;
+            uint64_t start;
+        };
+        
+        Profiler();
+        
+        bool enabled;
+        
+        /** Starts a new frame; events recorded afterwards belong to it. */
+        void beginFrame() { frame++; }
+        int currentFrame() const { return frame; }
+        
+        void record( const char *stage, int level, int count, uint64_t start, uint64_t end );
+        
+        const std::vector<Event> & getEvents() const { return events; }
+        void clear();
+        
+        /** Writes one line per event: frame, level, stage, count, start and duration in microseconds. */
+        bool writeCSV( const std::string &path ) const;
+        
+        /** Writes the events as complete ("X") events of the Chrome trace event format. */
+        bool writeTrace( const std::string &path ) const;
+        
+    protected:
+        uint64_t origin;
+        int frame;
+        std::vector<Event> events;
+    };
+
+/**
+ * @}
+ */
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 
 #include <MultiView/multiview.h>
 #include <PatchTracker/patch.h>
+#include <PatchTracker/pointstore.h>
 #include <vector>
 
 namespace vrlt {
@@ -22,14 +23,48 @@ namespace vrlt {
         int niter;
         float ksq;
         Node *root;
+        
+        // statistics of the last call to run(), from the normal equations of its final iteration
+        int ninliers;                               ///< Number of points with non-zero weight.
+        double rms;                                 ///< RMS reprojection error of those points, in pixels.
+        Eigen::Matrix<double,6,6> covariance;       ///< Covariance of the update exp(d)*pose; zero if fewer than three inliers.
     
-        RobustLeastSq( Node *_root ) : niter( 10 ), ksq( 1.f ), root( _root )
+        RobustLeastSq( Node *_root ) : niter( 10 ), ksq( 1.f ), root( _root ), ninliers( 0 ), rms( 0 ), covariance( Eigen::Matrix<double,6,6>::Zero() ), store( NULL )
         {
         }
 
         bool updatePose( Camera *camera_in, int iter, float eps );
 
+        /** Refines the pose of the camera from the tracked points of the map. */
         bool run( Camera *camera_in );
+        
+        /** Same as run(), but takes the tracked points from the tracker's point store instead of searching the map. */
+        bool run( Camera *camera_in, PointStore &_store );
+        
+    protected:
+        bool solve( Camera *camera_in );
+        void computeResiduals( const Sophus::SE3f &pose, float f, const Eigen::Vector2f &center );
+        
+        // the tracked points, packed once per run
+        std::vector<Point*> points;
+        std::vector<size_t> storeIndices;
+        PointStore *store;
+        Eigen::ArrayXf X, Y, Z;             // positions
+        Eigen::ArrayXf u, v;                // measured locations
+        
+        // per-point values of the current iteration
+        Eigen::ArrayXf invZ;                // inverse depths
+        Eigen::ArrayXf xn, yn;              // normalized image coordinates
+        Eigen::ArrayXf ex, ey;              // residuals
+        Eigen::ArrayXf residualsqs;
+        Eigen::ArrayXf weights;
+        
+
+        Eigen::Matrix<float,6,6> lastFtF;
+        float lastWeightedErr;
+        float lastWeightSum;
+        float lastInlierErr;
+        int lastNumInliers;
     };
 }
 
@@ -25,7 +25,29 @@ namespace vrlt {
     {
         virtual bool samplePatch( cv::Mat &sourceImage, const Eigen::Vector2f &center, cv::Mat &templatePatch );
         virtual bool samplePatch( cv::Mat &sourceImage, const Eigen::Vector2f &center, const Eigen::Matrix3f &warp, float scale, cv::Mat &templatePatch );
+        
+        /** Returns the matrix mapping pixels of a size x size patch to the source image, as used by samplePatch(). */
+        static Eigen::Matrix3f warpMatrix( const Eigen::Vector2f &center, const Eigen::Matrix3f &warp, float scale, int size );
     };
+    
+    /** \brief An 8x8 patch to be sampled by warpPatches(). */
+    struct PatchWarp
+    {
+        const cv::Mat *image;   // 8-bit grayscale source image
+        Eigen::Matrix3f M;      // maps patch pixels to source image pixels
+        unsigned char *patch;   // 64 bytes, row by row
+    };
+    
+    /**
+     * \brief Samples an 8x8 patch at the source pixels M * (x,y,1) with bilinear interpolation.
+     *
+     * Uses the fixed-point arithmetic of cv::warpPerspective with WARP_INVERSE_MAP and a zero border, so gives the
+     * same result, without the setup cost of the generic function.
+     */
+    void warpPatch( const cv::Mat &image, const Eigen::Matrix3f &M, unsigned char *patch );
+    
+    /** Samples a batch of patches with warpPatch(). */
+    void warpPatches( const PatchWarp *warps, int count );
 
 /**
  * @}
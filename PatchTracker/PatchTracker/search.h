@@ -12,6 +12,7 @@
 #define SEARCH_H
 
 #include <PatchTracker/patch.h>
+#include <PatchTracker/patchatlas.h>
 
 #include "timer.h"
 
@@ -29,11 +30,12 @@ namespace vrlt
         int level;
         float lowThreshold, highThreshold;
         std::vector<Patch*>::iterator begin;
+        const PatchAtlas *atlas;    // source of the templates of the features it holds, instead of the source camera images, if not NULL
         
         Timer warpTimer;
         Timer searchTimer;
         
-        PatchSearch() : subsample( false ) { }
+        PatchSearch() : subsample( false ), atlas( NULL ) { }
         virtual ~PatchSearch() { }
         
         virtual int makeTemplates( int count ) { return 0; }
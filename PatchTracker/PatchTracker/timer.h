@@ -5,37 +5,33 @@
  *
  * File: timing.h
  * Author: Jonathan Ventura
- * Last Modified: 7.19.2014
+ * Last Modified: 18.10.2026
  */
 
 #ifndef TIMER_H
 #define TIMER_H
 
-#ifdef __APPLE__
-#include "mach/mach_time.h"
-#endif
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 
 struct Timer
 {
-#ifdef __APPLE__
-    Timer() : nsamples( 0 ), total( 0 ) { mach_timebase_info(&info); }
-    uint64_t getTime() { return mach_absolute_time(); }
-    double convertToNanoseconds( uint64_t duration ) { return (duration * info.numer) / info.denom; }
-#else
-    Timer() : nsamples( 0 ), total( 0 ) {}
-    uint64_t getTime() { return 0; }
-    double convertToNanonseconds( uint64_t duration ) { return 0.; }
-#endif
+    Timer() : nsamples( 0 ), total( 0 ), start_time( 0 ) {}
+    
+    /** Monotonic time in nanoseconds. */
+    static uint64_t getTime() { return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count(); }
+    double convertToNanoseconds( uint64_t duration ) { return (double)duration; }
+    
     void reset() { nsamples = 0; total = 0; }
     void start() { start_time = getTime(); }
     void stop() { total += getTime()-start_time; nsamples++; }
-    double average() { return ((double)total)/nsamples; }
+    
+    /** Average duration in nanoseconds. */
+    double average() { return ( nsamples > 0 ) ? ((double)total)/nsamples : 0.; }
 private:
     size_t nsamples;
     uint64_t total;
-#ifdef __APPLE__
-    mach_timebase_info_data_t info;
-#endif
     uint64_t start_time;
 };
 
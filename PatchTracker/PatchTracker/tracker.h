@@ -12,9 +12,17 @@
 #define TRACKER_H
 
 #include <MultiView/multiview.h>
+#include <PatchTracker/imageprovider.h>
+#include <PatchTracker/patchatlas.h>
+#include <PatchTracker/patchbudget.h>
+#include <PatchTracker/pointgrid.h>
+#include <PatchTracker/pointstore.h>
+#include <PatchTracker/profiler.h>
 
 #include "timer.h"
 
+#include <map>
+
 namespace vrlt {
     class Patch;
     class PatchSearch;
@@ -45,11 +53,17 @@ namespace vrlt {
         int minnumpoints;
         int nattempted;
         float minratio;
+        bool reuse_visible;     // only re-check the points found visible by the last call, instead of culling the whole map
         
         Timer cullTimer;
+        Profiler profiler;      // per-frame stage timings; set profiler.enabled to record them
+        PatchBudget budget;     // set budget.frameTime to adapt the number of patches and the first level to a time target
+        const PatchAtlas *atlas;    // if set, templates come from this atlas and the keyframe images need not be loaded
+        ImageProvider *images;      // if set, and there is no atlas, loads the source images as they are needed
+        int nprefetch;              // number of cameras, near the current pose or recently chosen as sources, whose images are loaded ahead
 
-        cv::Mat grid;
-        cv::Size gridstep;
+        cv::Mat grid;           // patches taken from each image cell, when not all of them can be searched
+        cv::Size gridstep;      // size of the cells in pixels
         
 //        CVD::Image<bool> grid8;
 //        CVD::ImageRef gridstep8;
@@ -83,14 +97,23 @@ namespace vrlt {
         std::vector<Camera*> cameras;
         std::vector<Patch*> patches;
         std::vector<Patch*> visiblePatches;
+        std::vector<size_t> visibleIndices;
+        std::vector<size_t> candidateIndices;   // points to check this frame, then those inside the image
+        PointGrid pointGrid;                    // positions of the points in patches, for culling
+        PointStore pointStore;                  // the points of patches, in the same order
         std::vector<Patch*> searchPatches;
         PatchSearch *patchSearcher;
         
         void setCurrentCamera( Camera *c );
+        void spreadPatches( int count );
+        void provideImages( int count );
+        std::map<Camera*,double> sourceUse;     // share of the patches recently taken from each camera, decayed each frame
         Camera *current_camera;
         Eigen::Matrix<float,3,4> poseMatrix;
         float f, u, v, k1, k2;
         friend void checkPoint( void *context, size_t i );
+        friend void checkCandidate( void *context, size_t i );
+        friend void selectSource( void *context, size_t i );
         friend void preparePatch( void *context, size_t i );
         friend void updatePatch( void *context, size_t i );
         
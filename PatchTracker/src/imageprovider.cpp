@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: imageprovider.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/imageprovider.h>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace vrlt
+{
+    static size_t pyramidBytes( const ImagePyramid &pyramid )
+    {
+        size_t bytes = 0;
+        for ( int l = 0; l < NLEVELS; l++ ) bytes += pyramid.levels[l].image.total() * pyramid.levels[l].image.elemSize();
+        return bytes;
+    }
+    
+    ImageProvider::ImageProvider( const std::string &_prefix, size_t _maxBytes )
+    : nhits( 0 ), nprefetched( 0 ), nmisses( 0 ), prefix( _prefix ), maxBytes( _maxBytes ), nbytes( 0 ), frame( 0 ),
+      loading( NULL ), stopping( false )
+    {
+        loader = std::thread( &ImageProvider::loaderLoop, this );
+    }
+    
+    ImageProvider::~ImageProvider()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+        cond.notify_all();
+        loader.join();
+        
+        while ( !residents.empty() ) evict( residents.begin()->first );
+    }
+    
+    bool ImageProvider::load( Camera *camera, ImagePyramid &pyramid )
+    {
+        std::stringstream path;
+        path << prefix << "/" << camera->path;
+        cv::Mat image = cv::imread( path.str(), cv::IMREAD_GRAYSCALE );
+        if ( image.empty() )
+        {
+            bool first;
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                first = failed.insert( camera ).second;
+            }
+            if ( first ) std::cerr << "error: could not read image " << path.str() << "\n";
+            return false;
+        }
+        
+        pyramid.levels[0].image = image;
+        pyramid.remake();
+        return true;
+    }
+    
+    void ImageProvider::install( Camera *camera, const ImagePyramid &pyramid, bool prefetched )
+    {
+        camera->pyramid = pyramid;
+        camera->pyramid.camera = camera;
+        camera->image = camera->pyramid.levels[0].image;
+        
+        Resident &resident = residents[camera];
+        resident.bytes = pyramidBytes( pyramid );
+        // prefetched pyramids have not been used yet, so they may be evicted before this frame's are
+        resident.lastUsed = ( prefetched ) ? frame - 1 : frame;
+        resident.prefetched = prefetched;
+        nbytes += resident.bytes;
+    }
+    
+    void ImageProvider::installReady()
+    {
+        std::vector< std::pair<Camera*,ImagePyramid> > arrived;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            arrived.swap( ready );
+        }
+        
+        for ( size_t i = 0; i < arrived.size(); i++ )
+        {
+            if ( !resident( arrived[i].first ) ) install( arrived[i].first, arrived[i].second, true );
+        }
+    }
+    
+    void ImageProvider::evict( Camera *camera )
+    {
+        std::map<Camera*,Resident>::iterator it = residents.find( camera );
+        if ( it == residents.end() ) return;
+        
+        nbytes -= it->second.bytes;
+        residents.erase( it );
+        
+        camera->pyramid = ImagePyramid();
+        camera->image = cv::Mat();
+    }
+    
+    void ImageProvider::require( const std::vector<Camera*> &cameras )
+    {
+        frame++;
+        installReady();
+        
+        for ( size_t i = 0; i < cameras.size(); i++ )
+        {
+            Camera *camera = cameras[i];
+            std::map<Camera*,Resident>::iterator it = residents.find( camera );
+            if ( it != residents.end() )
+            {
+                if ( it->second.prefetched ) nprefetched++;
+                else nhits++;
+                it->second.lastUsed = frame;
+                it->second.prefetched = false;
+                continue;
+            }
+            
+            // cameras whose images were set elsewhere, such as new keyframes, are not managed here
+            if ( !camera->pyramid.levels[0].image.empty() ) continue;
+            
+            // take the camera off the queue, or wait if it is being loaded
+            bool unreadable;
+            {
+                std::unique_lock<std::mutex> lock( mutex );
+                pending.erase( std::remove( pending.begin(), pending.end(), camera ), pending.end() );
+                cond.wait( lock, [this,camera]{ return loading != camera; } );
+                unreadable = ( failed.find( camera ) != failed.end() );
+            }
+            if ( unreadable ) continue;
+            installReady();
+            if ( resident( camera ) )
+            {
+                residents[camera].lastUsed = frame;
+                residents[camera].prefetched = false;
+                nprefetched++;
+                continue;
+            }
+            
+            ImagePyramid pyramid;
+            if ( !load( camera, pyramid ) ) continue;
+            install( camera, pyramid, false );
+            nmisses++;
+        }
+        
+        // evict the least recently used pyramids, never those required now; prefetched ones only count as used once required
+        while ( nbytes > maxBytes )
+        {
+            Camera *oldest = NULL;
+            size_t oldestUse = frame;
+            std::map<Camera*,Resident>::iterator it;
+            for ( it = residents.begin(); it != residents.end(); it++ )
+            {
+                if ( it->second.lastUsed < oldestUse )
+                {
+                    oldest = it->first;
+                    oldestUse = it->second.lastUsed;
+                }
+            }
+            if ( oldest == NULL ) break;
+            evict( oldest );
+        }
+    }
+    
+    void ImageProvider::prefetch( const std::vector<Camera*> &cameras )
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            pending.clear();
+            for ( size_t i = 0; i < cameras.size(); i++ )
+            {
+                if ( resident( cameras[i] ) || cameras[i] == loading || !cameras[i]->pyramid.levels[0].image.empty() ) continue;
+                if ( failed.find( cameras[i] ) != failed.end() ) continue;
+                
+                bool arrived = false;
+                for ( size_t j = 0; j < ready.size() && !arrived; j++ ) arrived = ( ready[j].first == cameras[i] );
+                if ( !arrived ) pending.push_back( cameras[i] );
+            }
+        }
+        cond.notify_all();
+    }
+    
+    void ImageProvider::loaderLoop()
+    {
+        for ( ; ; )
+        {
+            Camera *camera;
+            {
+                std::unique_lock<std::mutex> lock( mutex );
+                cond.wait( lock, [this]{ return stopping || !pending.empty(); } );
+                if ( stopping ) break;
+                camera = pending.front();
+                pending.pop_front();
+                loading = camera;
+            }
+            
+            ImagePyramid pyramid;
+            bool good = load( camera, pyramid );
+            
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                if ( good ) ready.push_back( std::make_pair( camera, pyramid ) );
+                loading = NULL;
+            }
+            cond.notify_all();
+        }
+    }
+}
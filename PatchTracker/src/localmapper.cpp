@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: localmapper.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/localmapper.h>
+#include <PatchTracker/tracker.h>
+
+#include <cstdio>
+
+namespace vrlt
+{
+    LocalMapper::LocalMapper()
+    : nsubmitted( 0 ), ndropped( 0 ), nadded( 0 ), pending( NULL ), building( false ), stopping( false )
+    {
+        mapper = std::thread( &LocalMapper::mapperLoop, this );
+    }
+
+    LocalMapper::~LocalMapper()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            stopping = true;
+        }
+        cond.notify_all();
+        mapper.join();
+
+        delete pending;
+        for ( size_t i = 0; i < ready.size(); i++ ) destroy( ready[i] );
+    }
+
+    bool LocalMapper::busy()
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        return ( pending != NULL || building || !ready.empty() );
+    }
+
+    bool LocalMapper::submit( const Camera *camera, const cv::Mat &image, const Tracker &tracker )
+    {
+        if ( busy() )
+        {
+            ndropped++;
+            return false;
+        }
+
+        Candidate *candidate = new Candidate;
+        candidate->image = image;
+        candidate->pose = camera->node->pose;
+        candidate->calibration = camera->calibration;
+
+        // only the points tracked in this frame, whose locations the next frame overwrites
+        const PointStore &store = tracker.pointStore;
+        candidate->observations.reserve( store.trackedIndices.size() );
+        for ( size_t j = 0; j < store.trackedIndices.size(); j++ )
+        {
+            Point *point = store.points[ store.trackedIndices[j] ];
+            if ( !point->tracked || point->track == NULL ) continue;
+            candidate->observations.push_back( std::make_pair( point, point->location ) );
+        }
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            pending = candidate;
+        }
+        cond.notify_all();
+
+        nsubmitted++;
+        return true;
+    }
+
+    LocalMapper::Keyframe * LocalMapper::build( const Candidate &candidate )
+    {
+        Keyframe *keyframe = new Keyframe;
+        keyframe->calibration = candidate.calibration;
+
+        Camera *camera = new Camera;
+        camera->isnew = true;
+        keyframe->camera = camera;
+
+        // the candidate's image was taken for the mapper alone, so the camera can share it
+        camera->image = candidate.image;
+        camera->pyramid.resize( camera->image.size() );
+        camera->pyramid.copy_from( camera->image );
+        camera->pyramid.camera = camera;
+
+        Node *node = new Node;
+        node->camera = camera;
+        camera->node = node;
+        node->pose = candidate.pose;
+        node->precomputedGlobalPose = candidate.pose;
+
+        keyframe->features.reserve( candidate.observations.size() );
+        for ( size_t i = 0; i < candidate.observations.size(); i++ )
+        {
+            Feature *feature = new Feature;
+            feature->location[0] = (double)candidate.observations[i].second[0];
+            feature->location[1] = (double)candidate.observations[i].second[1];
+
+            // set feature color
+            feature->color[0] = 255;
+            feature->color[1] = 255;
+            feature->color[2] = 0;
+
+            feature->camera = camera;
+            keyframe->features.push_back( std::make_pair( candidate.observations[i].first, feature ) );
+        }
+
+        return keyframe;
+    }
+
+    void LocalMapper::destroy( Keyframe *keyframe )
+    {
+        for ( size_t i = 0; i < keyframe->features.size(); i++ ) delete keyframe->features[i].second;
+        delete keyframe->camera->node;
+        delete keyframe->camera;
+        delete keyframe;
+    }
+
+    int LocalMapper::apply( Reconstruction &r, Tracker &tracker )
+    {
+        // swap the finished keyframes out of the back buffer, so the mapping thread can go on filling it
+        std::vector<Keyframe*> arrived;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            if ( ready.empty() ) return 0;
+            arrived.swap( ready );
+        }
+
+        char name[1024];
+        Node *root = (Node*)r.nodes["root"];
+
+        for ( size_t k = 0; k < arrived.size(); k++ )
+        {
+            Keyframe *keyframe = arrived[k];
+            Camera *camera = keyframe->camera;
+            Node *node = camera->node;
+
+            // names are numbered by the reconstruction, so they are only given here
+            sprintf( name, "newcamera%06d", (int)r.cameras.size()+1 );
+            camera->name = name;
+            r.cameras[ camera->name ] = camera;
+
+            // create calibration if necessary
+            Calibration *calibration = NULL;
+            if ( r.calibrations.count( keyframe->calibration->name ) == 0 ) {
+                calibration = new Calibration;
+                calibration->name = keyframe->calibration->name;
+                calibration->focal = keyframe->calibration->focal;
+                calibration->center = keyframe->calibration->center;
+                calibration->makeK();
+                calibration->makeKinverse();
+                r.calibrations[ calibration->name ] = calibration;
+            } else {
+                calibration = (Calibration*)r.calibrations[ keyframe->calibration->name ];
+            }
+            camera->calibration = calibration;
+
+            sprintf( name, "newnode%06d", (int)root->children.size()+1 );
+            node->name = name;
+            node->parent = root;
+            root->children[ node->name ] = node;
+
+            // link the features into the camera and the tracks of their points
+            int num_features = r.features.size();
+            for ( size_t i = 0; i < keyframe->features.size(); i++ )
+            {
+                Point *point = keyframe->features[i].first;
+                Feature *feature = keyframe->features[i].second;
+                Track *track = point->track;
+
+                sprintf( name, "feature%06d", num_features++ );
+                feature->name = name;
+                r.features[ feature->name ] = feature;
+                camera->features[ feature->name ] = feature;
+
+                track->features[ feature->name ] = feature;
+                feature->track = track;
+            }
+
+            tracker.cameras.push_back( camera );
+            nadded++;
+            delete keyframe;
+        }
+
+        return (int)arrived.size();
+    }
+
+    void LocalMapper::mapperLoop()
+    {
+        for ( ; ; )
+        {
+            Candidate *candidate;
+            {
+                std::unique_lock<std::mutex> lock( mutex );
+                cond.wait( lock, [this]{ return stopping || pending != NULL; } );
+                if ( stopping ) break;
+                candidate = pending;
+                pending = NULL;
+                building = true;
+            }
+
+            Keyframe *keyframe = build( *candidate );
+            delete candidate;
+
+            {
+                std::lock_guard<std::mutex> lock( mutex );
+                ready.push_back( keyframe );
+                building = false;
+            }
+        }
+    }
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: motionmodel.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/motionmodel.h>
+
+#include <cmath>
+
+namespace vrlt
+{
+    // the NCC search covers four pixels around the prediction at each pyramid level
+    static const double kSearchRadius = 4.;
+    // the error estimate follows increases at once and decays by this factor per frame
+    static const double kErrorDecay = 0.7;
+    
+    static bool hasAttitude( const Sophus::SO3d &attitude )
+    {
+        // cameras without sensor data keep the identity
+        return ( attitude.log().norm() > 0 );
+    }
+    
+    MotionModel::MotionModel()
+    : imuToCamera(), damping( 0.8 ), errorMargin( 2. )
+    {
+        reset();
+    }
+    
+    void MotionModel::reset()
+    {
+        have_pose = false;
+        have_velocity = false;
+        have_error = false;
+        last_time = 0;
+        velocity.setZero();
+        error = 0;
+    }
+    
+    Sophus::SE3d MotionModel::predict( const Camera *camera )
+    {
+        if ( !have_pose ) return camera->node->pose;
+        
+        bool have_time = ( camera->timestamp > 0 && last_time > 0 && camera->timestamp > last_time );
+        double dt = ( have_time ) ? camera->timestamp - last_time : 1.;
+        
+        Sophus::SE3d motion;
+        if ( have_velocity ) motion = Sophus::SE3d::exp( damping * dt * velocity );
+        
+        if ( hasAttitude( camera->attitude ) && hasAttitude( last_attitude ) )
+        {
+            Sophus::SO3d attitude = imuToCamera * camera->attitude * imuToCamera.inverse();
+            Sophus::SO3d prev_attitude = imuToCamera * last_attitude * imuToCamera.inverse();
+            motion = Sophus::SE3d( attitude * prev_attitude.inverse(), motion.translation() );
+        }
+        else if ( have_time && camera->rotationRate.norm() > 0 )
+        {
+            // integrate the rate as the device does, about z, y and x in turn
+            Eigen::Vector3d angle = camera->rotationRate * dt;
+            Sophus::SO3d gyro = Sophus::SO3d::exp( Eigen::Vector3d( 0, 0, angle[2] ) ) * Sophus::SO3d::exp( Eigen::Vector3d( 0, angle[1], 0 ) ) * Sophus::SO3d::exp( Eigen::Vector3d( angle[0], 0, 0 ) );
+            gyro = imuToCamera * gyro * imuToCamera.inverse();
+            
+            // the device turning by gyro turns the world the other way in camera coordinates
+            motion = Sophus::SE3d( gyro.inverse(), motion.translation() );
+        }
+        
+        predicted = motion * last_pose;
+        return predicted;
+    }
+    
+    void MotionModel::update( const Camera *camera, const Sophus::SE3d &pose )
+    {
+        if ( have_pose )
+        {
+            // how far the prediction was off
+            double residual = ( pose.so3() * predicted.so3().inverse() ).log().norm();
+            error = ( have_error ) ? std::max( residual, kErrorDecay * error ) : residual;
+            have_error = true;
+            
+            bool have_time = ( camera->timestamp > 0 && last_time > 0 && camera->timestamp > last_time );
+            double dt = ( have_time ) ? camera->timestamp - last_time : 1.;
+            velocity = ( pose * last_pose.inverse() ).log() / dt;
+            have_velocity = true;
+        }
+        
+        last_pose = pose;
+        last_attitude = camera->attitude;
+        last_time = camera->timestamp;
+        predicted = pose;
+        have_pose = true;
+    }
+    
+    double MotionModel::expectedError( double focal ) const
+    {
+        if ( !have_error ) return INFINITY;
+        return errorMargin * focal * tan( std::min( error, M_PI / 4 ) );
+    }
+    
+    int MotionModel::firstLevel( double focal, int lastlevel, int maxlevel ) const
+    {
+        double expected = expectedError( focal );
+        int level = lastlevel;
+        while ( level < maxlevel && kSearchRadius * ( 1 << level ) < expected ) level++;
+        return level;
+    }
+}
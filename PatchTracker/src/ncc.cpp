@@ -12,19 +12,459 @@
 
 #ifdef __ARM_NEON__
 #include <arm_neon.h>
+#elif ( defined(__x86_64__) || defined(__i386__) ) && defined(__GNUC__)
+#define NCC_X86
+#include <immintrin.h>
 #endif
 
 #include <cstdio>
+#include <cstring>
 
 namespace vrlt {
     
+#ifdef __ARM_NEON__
+    NCCKernel getNCCKernel()
+    {
+        return NCCKernelNEON;
+    }
+    
+    bool setNCCKernel( NCCKernel kernel )
+    {
+        return ( kernel == NCCKernelNEON );
+    }
+#else
+    // scalar reference implementations
+    
+    static unsigned int sumScalar( unsigned char *x )
+    {
+        unsigned int result = 0;
+        for ( int i = 0; i < 64; i++ ) result += x[i];
+        return result;
+    }
+    
+    static unsigned int sumSqScalar( unsigned char *x )
+    {
+        unsigned int result = 0;
+        for ( int i = 0; i < 64; i++ ) result += (unsigned int)x[i]*x[i];
+        return result;
+    }
+    
+    static unsigned int dotProductScalar( unsigned char *x, unsigned char *y )
+    {
+        unsigned int result = 0;
+        for ( int i = 0; i < 64; i++ ) result += (unsigned int)x[i]*y[i];
+        return result;
+    }
+    
+    static unsigned int sumStridedScalar( unsigned char *x, int rowstep )
+    {
+        unsigned int result = 0;
+        unsigned char *ptr = x;
+        for ( int i = 0; i < 8; i++,ptr+=rowstep )
+            for ( int j = 0; j < 8; j++ ) result += ptr[j];
+        return result;
+    }
+    
+    static unsigned int sumSqStridedScalar( unsigned char *x, int rowstep )
+    {
+        unsigned int result = 0;
+        unsigned char *ptr = x;
+        for ( int i = 0; i < 8; i++,ptr+=rowstep )
+            for ( int j = 0; j < 8; j++ ) result += (unsigned int)ptr[j]*ptr[j];
+        return result;
+    }
+    
+    static unsigned int dotProductStridedScalar( unsigned char *x, int rowstep, unsigned char *y )
+    {
+        unsigned int result = 0;
+        unsigned char *xptr = x;
+        unsigned char *yptr = y;
+        for ( int i = 0; i < 8; i++,xptr+=rowstep,yptr+=8 )
+            for ( int j = 0; j < 8; j++ ) result += (unsigned int)xptr[j]*yptr[j];
+        return result;
+    }
+    
+    static void windowStatisticsScalar( unsigned char *x, int rowstep, unsigned char *y, unsigned int *sums, unsigned int *sumsqs, unsigned int *dots )
+    {
+        // sums over the eight columns of each window, in each of the 15 rows of the region
+        unsigned int rowsums[15][8];
+        unsigned int rowsqs[15][8];
+        for ( int r = 0; r < 15; r++ )
+        {
+            unsigned char *ptr = x + r*rowstep;
+            for ( int dx = 0; dx < 8; dx++ )
+            {
+                unsigned int sum = 0;
+                unsigned int sumsq = 0;
+                for ( int j = 0; j < 8; j++ )
+                {
+                    sum += ptr[dx+j];
+                    sumsq += (unsigned int)ptr[dx+j]*ptr[dx+j];
+                }
+                rowsums[r][dx] = sum;
+                rowsqs[r][dx] = sumsq;
+            }
+        }
+        
+        for ( int dy = 0; dy < 8; dy++ )
+        {
+            for ( int dx = 0; dx < 8; dx++ )
+            {
+                unsigned int sum = 0;
+                unsigned int sumsq = 0;
+                for ( int i = 0; i < 8; i++ )
+                {
+                    sum += rowsums[dy+i][dx];
+                    sumsq += rowsqs[dy+i][dx];
+                }
+                sums[8*dy+dx] = sum;
+                sumsqs[8*dy+dx] = sumsq;
+                dots[8*dy+dx] = dotProductStridedScalar( x + dy*rowstep + dx, rowstep, y );
+            }
+        }
+    }
+    
+#ifdef NCC_X86
+    // SSE4.1 and AVX2 implementations, compiled for those instruction sets whatever the target of the rest of the build
+    // and chosen at run time.  All sums are exact in 32 bits: a product of two bytes is at most 65025, so pairs of
+    // them fit the 32-bit lanes of pmaddwd, and all 64 of them fit in 22 bits.
+    
+    // sums of 64-bit lanes
+    __attribute__((target("sse4.1")))
+    static inline unsigned int horizontalSum64( __m128i v )
+    {
+        return (unsigned int)( _mm_cvtsi128_si32( v ) + _mm_extract_epi32( v, 2 ) );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static inline unsigned int horizontalSum32( __m128i v )
+    {
+        v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        v = _mm_add_epi32( v, _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        return (unsigned int)_mm_cvtsi128_si32( v );
+    }
+    
+    // two rows of eight bytes
+    __attribute__((target("sse4.1")))
+    static inline __m128i loadRows( unsigned char *x, int rowstep )
+    {
+        return _mm_unpacklo_epi64( _mm_loadl_epi64( (__m128i*)x ), _mm_loadl_epi64( (__m128i*)( x + rowstep ) ) );
+    }
+    
+    // sum of squares or products of sixteen bytes, as four 32-bit sums
+    __attribute__((target("sse4.1")))
+    static inline __m128i multiplyAdd16( __m128i x, __m128i y )
+    {
+        __m128i lo = _mm_madd_epi16( _mm_cvtepu8_epi16( x ), _mm_cvtepu8_epi16( y ) );
+        __m128i hi = _mm_madd_epi16( _mm_cvtepu8_epi16( _mm_srli_si128( x, 8 ) ), _mm_cvtepu8_epi16( _mm_srli_si128( y, 8 ) ) );
+        return _mm_add_epi32( lo, hi );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int sumSSE41( unsigned char *x )
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i sum = _mm_sad_epu8( _mm_loadu_si128( (__m128i*)x ), zero );
+        for ( int i = 16; i < 64; i += 16 ) sum = _mm_add_epi64( sum, _mm_sad_epu8( _mm_loadu_si128( (__m128i*)( x + i ) ), zero ) );
+        return horizontalSum64( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int sumSqSSE41( unsigned char *x )
+    {
+        __m128i sum = _mm_setzero_si128();
+        for ( int i = 0; i < 64; i += 16 )
+        {
+            __m128i v = _mm_loadu_si128( (__m128i*)( x + i ) );
+            sum = _mm_add_epi32( sum, multiplyAdd16( v, v ) );
+        }
+        return horizontalSum32( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int dotProductSSE41( unsigned char *x, unsigned char *y )
+    {
+        __m128i sum = _mm_setzero_si128();
+        for ( int i = 0; i < 64; i += 16 ) sum = _mm_add_epi32( sum, multiplyAdd16( _mm_loadu_si128( (__m128i*)( x + i ) ), _mm_loadu_si128( (__m128i*)( y + i ) ) ) );
+        return horizontalSum32( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int sumStridedSSE41( unsigned char *x, int rowstep )
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+        for ( int i = 0; i < 8; i += 2, x += 2*rowstep ) sum = _mm_add_epi64( sum, _mm_sad_epu8( loadRows( x, rowstep ), zero ) );
+        return horizontalSum64( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int sumSqStridedSSE41( unsigned char *x, int rowstep )
+    {
+        __m128i sum = _mm_setzero_si128();
+        for ( int i = 0; i < 8; i += 2, x += 2*rowstep )
+        {
+            __m128i v = loadRows( x, rowstep );
+            sum = _mm_add_epi32( sum, multiplyAdd16( v, v ) );
+        }
+        return horizontalSum32( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static unsigned int dotProductStridedSSE41( unsigned char *x, int rowstep, unsigned char *y )
+    {
+        __m128i sum = _mm_setzero_si128();
+        for ( int i = 0; i < 8; i += 2, x += 2*rowstep, y += 16 ) sum = _mm_add_epi32( sum, multiplyAdd16( loadRows( x, rowstep ), _mm_loadu_si128( (__m128i*)y ) ) );
+        return horizontalSum32( sum );
+    }
+    
+    __attribute__((target("sse4.1")))
+    static void windowStatisticsSSE41( unsigned char *x, int rowstep, unsigned char *y, unsigned int *sums, unsigned int *sumsqs, unsigned int *dots )
+    {
+        // Each 32-bit lane handles one horizontal offset dx, four to a vector: lanes of "lo" vectors hold dx = 0..3
+        // and those of "hi" vectors dx = 4..7.  pmaddwd on the pixel pairs ( I[dx+j], I[dx+j+1] ) and the template
+        // pairs ( T[j], T[j+1] ) adds two products of a window row at once.
+        __m128i templatePairs[8][4];
+        for ( int i = 0; i < 8; i++ )
+            for ( int p = 0; p < 4; p++ )
+                templatePairs[i][p] = _mm_set1_epi32( y[8*i+2*p] | ( y[8*i+2*p+1] << 16 ) );
+        
+        __m128i ones = _mm_set1_epi16( 1 );
+        __m128i zero = _mm_setzero_si128();
+        
+        __m128i rowsumlo[15], rowsumhi[15], rowsqlo[15], rowsqhi[15];
+        __m128i dotlo[8], dothi[8];
+        for ( int dy = 0; dy < 8; dy++ ) dotlo[dy] = dothi[dy] = zero;
+        
+        for ( int r = 0; r < 15; r++ )
+        {
+            // columns 0 to 15 of the row; the windows cover 0 to 14
+            __m128i bytes = _mm_loadu_si128( (__m128i*)( x + r*rowstep ) );
+            __m128i shifted[8];
+            shifted[0] = _mm_cvtepu8_epi16( bytes );
+            shifted[1] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 1 ) );
+            shifted[2] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 2 ) );
+            shifted[3] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 3 ) );
+            shifted[4] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 4 ) );
+            shifted[5] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 5 ) );
+            shifted[6] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 6 ) );
+            shifted[7] = _mm_cvtepu8_epi16( _mm_srli_si128( bytes, 7 ) );
+            
+            __m128i pairlo[4], pairhi[4];
+            for ( int p = 0; p < 4; p++ )
+            {
+                pairlo[p] = _mm_unpacklo_epi16( shifted[2*p], shifted[2*p+1] );
+                pairhi[p] = _mm_unpackhi_epi16( shifted[2*p], shifted[2*p+1] );
+            }
+            
+            rowsumlo[r] = rowsumhi[r] = rowsqlo[r] = rowsqhi[r] = zero;
+            for ( int p = 0; p < 4; p++ )
+            {
+                rowsumlo[r] = _mm_add_epi32( rowsumlo[r], _mm_madd_epi16( pairlo[p], ones ) );
+                rowsumhi[r] = _mm_add_epi32( rowsumhi[r], _mm_madd_epi16( pairhi[p], ones ) );
+                rowsqlo[r] = _mm_add_epi32( rowsqlo[r], _mm_madd_epi16( pairlo[p], pairlo[p] ) );
+                rowsqhi[r] = _mm_add_epi32( rowsqhi[r], _mm_madd_epi16( pairhi[p], pairhi[p] ) );
+            }
+            
+            // this row is row i of the windows at dy = r - i
+            for ( int i = 0; i < 8; i++ )
+            {
+                int dy = r - i;
+                if ( dy < 0 || dy >= 8 ) continue;
+                for ( int p = 0; p < 4; p++ )
+                {
+                    dotlo[dy] = _mm_add_epi32( dotlo[dy], _mm_madd_epi16( pairlo[p], templatePairs[i][p] ) );
+                    dothi[dy] = _mm_add_epi32( dothi[dy], _mm_madd_epi16( pairhi[p], templatePairs[i][p] ) );
+                }
+            }
+        }
+        
+        // sliding sums of eight rows
+        __m128i sumlo = zero, sumhi = zero, sqlo = zero, sqhi = zero;
+        for ( int i = 0; i < 8; i++ )
+        {
+            sumlo = _mm_add_epi32( sumlo, rowsumlo[i] );
+            sumhi = _mm_add_epi32( sumhi, rowsumhi[i] );
+            sqlo = _mm_add_epi32( sqlo, rowsqlo[i] );
+            sqhi = _mm_add_epi32( sqhi, rowsqhi[i] );
+        }
+        for ( int dy = 0; dy < 8; dy++ )
+        {
+            if ( dy > 0 )
+            {
+                sumlo = _mm_add_epi32( sumlo, _mm_sub_epi32( rowsumlo[dy+7], rowsumlo[dy-1] ) );
+                sumhi = _mm_add_epi32( sumhi, _mm_sub_epi32( rowsumhi[dy+7], rowsumhi[dy-1] ) );
+                sqlo = _mm_add_epi32( sqlo, _mm_sub_epi32( rowsqlo[dy+7], rowsqlo[dy-1] ) );
+                sqhi = _mm_add_epi32( sqhi, _mm_sub_epi32( rowsqhi[dy+7], rowsqhi[dy-1] ) );
+            }
+            _mm_storeu_si128( (__m128i*)( sums + 8*dy ), sumlo );
+            _mm_storeu_si128( (__m128i*)( sums + 8*dy + 4 ), sumhi );
+            _mm_storeu_si128( (__m128i*)( sumsqs + 8*dy ), sqlo );
+            _mm_storeu_si128( (__m128i*)( sumsqs + 8*dy + 4 ), sqhi );
+            _mm_storeu_si128( (__m128i*)( dots + 8*dy ), dotlo[dy] );
+            _mm_storeu_si128( (__m128i*)( dots + 8*dy + 4 ), dothi[dy] );
+        }
+    }
+    
+    __attribute__((target("avx2")))
+    static inline unsigned int horizontalSum64( __m256i v )
+    {
+        __m128i sum = _mm_add_epi64( _mm256_castsi256_si128( v ), _mm256_extracti128_si256( v, 1 ) );
+        return (unsigned int)( _mm_cvtsi128_si32( sum ) + _mm_extract_epi32( sum, 2 ) );
+    }
+    
+    __attribute__((target("avx2")))
+    static inline unsigned int horizontalSum32( __m256i v )
+    {
+        __m128i sum = _mm_add_epi32( _mm256_castsi256_si128( v ), _mm256_extracti128_si256( v, 1 ) );
+        sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        return (unsigned int)_mm_cvtsi128_si32( sum );
+    }
+    
+    // four rows of eight bytes
+    __attribute__((target("avx2")))
+    static inline __m256i loadRows4( unsigned char *x, int rowstep )
+    {
+        __m128i lo = _mm_unpacklo_epi64( _mm_loadl_epi64( (__m128i*)x ), _mm_loadl_epi64( (__m128i*)( x + rowstep ) ) );
+        __m128i hi = _mm_unpacklo_epi64( _mm_loadl_epi64( (__m128i*)( x + 2*rowstep ) ), _mm_loadl_epi64( (__m128i*)( x + 3*rowstep ) ) );
+        return _mm256_inserti128_si256( _mm256_castsi128_si256( lo ), hi, 1 );
+    }
+    
+    // sum of squares or products of 32 bytes, as eight 32-bit sums
+    __attribute__((target("avx2")))
+    static inline __m256i multiplyAdd32( __m256i x, __m256i y )
+    {
+        __m256i lo = _mm256_madd_epi16( _mm256_cvtepu8_epi16( _mm256_castsi256_si128( x ) ), _mm256_cvtepu8_epi16( _mm256_castsi256_si128( y ) ) );
+        __m256i hi = _mm256_madd_epi16( _mm256_cvtepu8_epi16( _mm256_extracti128_si256( x, 1 ) ), _mm256_cvtepu8_epi16( _mm256_extracti128_si256( y, 1 ) ) );
+        return _mm256_add_epi32( lo, hi );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int sumAVX2( unsigned char *x )
+    {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i sum = _mm256_add_epi64( _mm256_sad_epu8( _mm256_loadu_si256( (__m256i*)x ), zero ),
+                                        _mm256_sad_epu8( _mm256_loadu_si256( (__m256i*)( x + 32 ) ), zero ) );
+        return horizontalSum64( sum );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int sumSqAVX2( unsigned char *x )
+    {
+        __m256i v0 = _mm256_loadu_si256( (__m256i*)x );
+        __m256i v1 = _mm256_loadu_si256( (__m256i*)( x + 32 ) );
+        return horizontalSum32( _mm256_add_epi32( multiplyAdd32( v0, v0 ), multiplyAdd32( v1, v1 ) ) );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int dotProductAVX2( unsigned char *x, unsigned char *y )
+    {
+        __m256i sum = _mm256_add_epi32( multiplyAdd32( _mm256_loadu_si256( (__m256i*)x ), _mm256_loadu_si256( (__m256i*)y ) ),
+                                        multiplyAdd32( _mm256_loadu_si256( (__m256i*)( x + 32 ) ), _mm256_loadu_si256( (__m256i*)( y + 32 ) ) ) );
+        return horizontalSum32( sum );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int sumStridedAVX2( unsigned char *x, int rowstep )
+    {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i sum = _mm256_add_epi64( _mm256_sad_epu8( loadRows4( x, rowstep ), zero ),
+                                        _mm256_sad_epu8( loadRows4( x + 4*rowstep, rowstep ), zero ) );
+        return horizontalSum64( sum );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int sumSqStridedAVX2( unsigned char *x, int rowstep )
+    {
+        __m256i v0 = loadRows4( x, rowstep );
+        __m256i v1 = loadRows4( x + 4*rowstep, rowstep );
+        return horizontalSum32( _mm256_add_epi32( multiplyAdd32( v0, v0 ), multiplyAdd32( v1, v1 ) ) );
+    }
+    
+    __attribute__((target("avx2")))
+    static unsigned int dotProductStridedAVX2( unsigned char *x, int rowstep, unsigned char *y )
+    {
+        __m256i sum = _mm256_add_epi32( multiplyAdd32( loadRows4( x, rowstep ), _mm256_loadu_si256( (__m256i*)y ) ),
+                                        multiplyAdd32( loadRows4( x + 4*rowstep, rowstep ), _mm256_loadu_si256( (__m256i*)( y + 32 ) ) ) );
+        return horizontalSum32( sum );
+    }
+#endif
+    
+    struct NCCKernels
+    {
+        NCCKernel kernel;
+        unsigned int (*sum)( unsigned char *x );
+        unsigned int (*sumSq)( unsigned char *x );
+        unsigned int (*dotProduct)( unsigned char *x, unsigned char *y );
+        unsigned int (*sumStrided)( unsigned char *x, int rowstep );
+        unsigned int (*sumSqStrided)( unsigned char *x, int rowstep );
+        unsigned int (*dotProductStrided)( unsigned char *x, int rowstep, unsigned char *y );
+        void (*windowStatistics)( unsigned char *x, int rowstep, unsigned char *y, unsigned int *sums, unsigned int *sumsqs, unsigned int *dots );
+    };
+    
+    static const NCCKernels scalarKernels = { NCCKernelScalar, sumScalar, sumSqScalar, dotProductScalar, sumStridedScalar, sumSqStridedScalar, dotProductStridedScalar, windowStatisticsScalar };
+#ifdef NCC_X86
+    static const NCCKernels sse41Kernels = { NCCKernelSSE41, sumSSE41, sumSqSSE41, dotProductSSE41, sumStridedSSE41, sumSqStridedSSE41, dotProductStridedSSE41, windowStatisticsSSE41 };
+    static const NCCKernels avx2Kernels = { NCCKernelAVX2, sumAVX2, sumSqAVX2, dotProductAVX2, sumStridedAVX2, sumSqStridedAVX2, dotProductStridedAVX2, windowStatisticsSSE41 };
+#endif
+    
+    static bool supported( NCCKernel kernel )
+    {
+        switch ( kernel )
+        {
+            case NCCKernelScalar:
+                return true;
+#ifdef NCC_X86
+            case NCCKernelSSE41:
+                return __builtin_cpu_supports( "sse4.1" );
+            case NCCKernelAVX2:
+                return __builtin_cpu_supports( "avx2" );
+#endif
+            default:
+                return false;
+        }
+    }
+    
+    static NCCKernels chooseKernels( NCCKernel kernel )
+    {
+#ifdef NCC_X86
+        if ( kernel == NCCKernelAVX2 ) return avx2Kernels;
+        if ( kernel == NCCKernelSSE41 ) return sse41Kernels;
+#endif
+        return scalarKernels;
+    }
+    
+    static NCCKernels chooseBestKernels()
+    {
+        if ( supported( NCCKernelAVX2 ) ) return chooseKernels( NCCKernelAVX2 );
+        if ( supported( NCCKernelSSE41 ) ) return chooseKernels( NCCKernelSSE41 );
+        return scalarKernels;
+    }
+    
+    static NCCKernels kernels = chooseBestKernels();
+    
+    NCCKernel getNCCKernel()
+    {
+        return kernels.kernel;
+    }
+    
+    bool setNCCKernel( NCCKernel kernel )
+    {
+        if ( !supported( kernel ) ) return false;
+        kernels = chooseKernels( kernel );
+        return true;
+    }
+#endif
+    
+
     void memcpy8( unsigned char *output, unsigned char *input )
     {
 #ifdef __ARM_NEON__
         uint8x8_t v0 = vld1_u8( input );
         vst1_u8( output, v0 );
 #else
-        for ( int i = 0; i < 8; i++ ) output[i] = input[i];
+        memcpy( output, input, 8 );
 #endif
     }
     
@@ -58,11 +498,7 @@ namespace vrlt {
         
         return (unsigned int) sum;
 #else
-        unsigned int result = 0;
-        unsigned char *ptr = x;
-        for ( int i = 0; i < 8; i++,ptr+=rowstep )
-            for ( int j = 0; j < 8; j++ ) result += ptr[j];
-        return result;
+        return kernels.sumStrided( x, rowstep );
 #endif
     }
     
@@ -90,9 +526,7 @@ namespace vrlt {
         
         return (unsigned int) (sums[0] + sums[1]);
 #else
-        unsigned int result = 0;
-        for ( int i = 0; i < 64; i++ ) result += x[i];
-        return result;
+        return kernels.sum( x );
 #endif
     }
     
@@ -134,11 +568,7 @@ namespace vrlt {
         
         return (unsigned int) (sums[0] + sums[1]);
 #else
-        unsigned int result = 0;
-        unsigned char *ptr = x;
-        for ( int i = 0; i < 8; i++,ptr+=rowstep )
-            for ( int j = 0; j < 8; j++ ) result += (unsigned int)ptr[j]*ptr[j];
-        return result;
+        return kernels.sumSqStrided( x, rowstep );
 #endif
     }
     
@@ -178,9 +608,7 @@ namespace vrlt {
         
         return (unsigned int) (sums[0] + sums[1]);
 #else
-        unsigned int result = 0;
-        for ( int i = 0; i < 64; i++ ) result += (unsigned int)x[i]*x[i];
-        return result;
+        return kernels.sumSq( x );
 #endif
     }
     
@@ -240,12 +668,7 @@ namespace vrlt {
         
         return (unsigned int) (sums[0] + sums[1]);
 #else
-        unsigned int result = 0;
-        unsigned char *xptr = x;
-        unsigned char *yptr = y;
-        for ( int i = 0; i < 8; i++,xptr+=rowstep,yptr+=8 )
-            for ( int j = 0; j < 8; j++ ) result += (unsigned int)xptr[j]*yptr[j];
-        return result;
+        return kernels.dotProductStrided( x, rowstep, y );
 #endif
     }
     
@@ -290,9 +713,25 @@ namespace vrlt {
         
         return (unsigned int) (sums[0] + sums[1]);
 #else
-        unsigned int result = 0;
-        for ( int i = 0; i < 64; i++ ) result += (unsigned int)x[i]*y[i];
-        return result;
+        return kernels.dotProduct( x, y );
+#endif
+    }
+    
+    void computeWindowStatistics( unsigned char *x, int rowstep, unsigned char *y, unsigned int *sums, unsigned int *sumsqs, unsigned int *dots )
+    {
+#ifdef __ARM_NEON__
+        for ( int dy = 0; dy < 8; dy++ )
+        {
+            for ( int dx = 0; dx < 8; dx++ )
+            {
+                unsigned char *ptr = x + dy*rowstep + dx;
+                sums[8*dy+dx] = computeSum( ptr, rowstep );
+                sumsqs[8*dy+dx] = computeSumSq( ptr, rowstep );
+                dots[8*dy+dx] = computeDotProduct( ptr, rowstep, y );
+            }
+        }
+#else
+        kernels.windowStatistics( x, rowstep, y, sums, sumsqs, dots );
 #endif
     }
 }
@@ -10,15 +10,16 @@
 
 #include <PatchTracker/nccsearch.h>
 #include <PatchTracker/ncc.h>
+#include <MultiView/parallel.h>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <Eigen/Eigen>
 
-#ifdef USE_DISPATCH
-#include <dispatch/dispatch.h>
-#endif
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 
 namespace vrlt
 {
@@ -27,13 +28,21 @@ namespace vrlt
         return ( loc.x >= 0 && loc.x < size.width && loc.y >= 0 && loc.y < size.height );
     }
     
+    // sub-pixel refinement uses the inner 6x6 pixels of the template, where central differences are defined
+    static const int kRefineSize = 6;
+    static const int kRefinePixels = kRefineSize * kRefineSize;
+    static const int kRefineIterations = 5;
+    
     PatchSearchNCC::PatchSearchNCC( int maxnumpoints )
+    : refine( true ), templateReuseThreshold( 0.25f ), nreused( 0 )
     {
         lowThreshold = highThreshold = 0.7;
         templates = new uchar[8 * 8 * maxnumpoints];
         targets = new uchar[8 * 8 * maxnumpoints];
         templateA = new float[maxnumpoints];
         templateC = new float[maxnumpoints];
+        templateJacobians = new float[2 * kRefinePixels * maxnumpoints];
+        templateHessians = new float[3 * maxnumpoints];
     }
     
     PatchSearchNCC::~PatchSearchNCC()
@@ -42,64 +51,292 @@ namespace vrlt
         delete [] targets;
         delete [] templateA;
         delete [] templateC;
+        delete [] templateJacobians;
+        delete [] templateHessians;
     }
     
-    static void makeNCCTemplate( void *context, size_t i )
+    typedef Eigen::Array<float,kRefinePixels,1> RefineArray;
+    
+    // gradients of the template for the inverse compositional refinement, which stay fixed over its iterations
+    static void computeTemplateJacobian( const uchar *templatePtr, float *J, float *Hinv )
     {
-        PatchSearchNCC *searcher = (PatchSearchNCC*)context;
-        Patch *patch = *(searcher->begin+i);
-        
-        uchar *templatePtr = searcher->templates + i*64;
-        float *Aptr = searcher->templateA + i;
-        float *Cptr = searcher->templateC + i;
+        Eigen::Map<RefineArray> gx( J );
+        Eigen::Map<RefineArray> gy( J + kRefinePixels );
+        for ( int y = 0; y < kRefineSize; y++ )
+        {
+            for ( int x = 0; x < kRefineSize; x++ )
+            {
+                const uchar *ptr = templatePtr + ( y + 1 ) * 8 + ( x + 1 );
+                gx[kRefineSize*y+x] = 0.5f * ( (float)ptr[1] - (float)ptr[-1] );
+                gy[kRefineSize*y+x] = 0.5f * ( (float)ptr[8] - (float)ptr[-8] );
+            }
+        }
         
-        cv::Mat templatePatch( cv::Size(8,8), CV_8UC1, templatePtr );
+        float a = ( gx * gx ).sum();
+        float b = ( gx * gy ).sum();
+        float c = ( gy * gy ).sum();
+        float det = a * c - b * b;
         
-        int level = 0;
-        float myscale = patch->scale;
-        while ( myscale > 3. ) {
-            if ( level == NLEVELS-1 ) break;
-            level++;
-            myscale /= 4.;
-        }
-        if ( myscale > 3. || myscale < 0.25 ) {
-            patch->shouldTrack = false;
+        // flat templates and straight edges do not fix both coordinates
+        if ( det <= 1e-3f * ( a + c ) * ( a + c ) )
+        {
+            Hinv[0] = Hinv[1] = Hinv[2] = 0;
             return;
         }
-        float levelScale = powf( 2.f, -level );
+        Hinv[0] = c / det;
+        Hinv[1] = -b / det;
+        Hinv[2] = a / det;
+    }
+    
+    /**
+     * Refines the position of the template in the image by inverse compositional Gauss-Newton on the inner 6x6
+     * pixels, starting from the 8x8 window at origin.  The window is normalized to the template's mean and contrast
+     * at each step, as NCC is.
+     * \param delta Receives the offset from origin, within one pixel in x and y.
+     */
+    static bool refinePosition( const cv::Mat &image, const cv::Point2i &origin, const uchar *templatePtr, const float *J, const float *Hinv, Eigen::Vector2f &delta )
+    {
+        if ( Hinv[0] == 0 && Hinv[2] == 0 ) return false;
         
-        bool good = patch->sampler.samplePatch( patch->source->pyramid.levels[level].image, patch->warpcenter, patch->warp, levelScale, templatePatch );
+        Eigen::Map<const RefineArray> gx( J );
+        Eigen::Map<const RefineArray> gy( J + kRefinePixels );
         
-        if ( !good ) {
-            patch->shouldTrack = false;
-            return;
+        RefineArray T;
+        for ( int y = 0; y < kRefineSize; y++ )
+        {
+            for ( int x = 0; x < kRefineSize; x++ ) T[kRefineSize*y+x] = templatePtr[( y + 1 ) * 8 + ( x + 1 )];
+        }
+        T -= T.mean();
+        float Tnorm = sqrtf( ( T * T ).sum() );
+        
+        const int rowstep = (int)image.step;
+        
+        delta.setZero();
+        for ( int iter = 0; iter < kRefineIterations; iter++ )
+        {
+            float fx = floorf( delta[0] );
+            float fy = floorf( delta[1] );
+            float ax = delta[0] - fx;
+            float ay = delta[1] - fy;
+            int ix = origin.x + 1 + (int)fx;
+            int iy = origin.y + 1 + (int)fy;
+            if ( ix < 0 || iy < 0 || ix + kRefineSize >= image.cols || iy + kRefineSize >= image.rows ) return false;
+            
+            RefineArray I;
+            for ( int y = 0; y < kRefineSize; y++ )
+            {
+                const uchar *ptr = image.ptr( iy + y ) + ix;
+                for ( int x = 0; x < kRefineSize; x++ )
+                {
+                    float top = ( 1.f - ax ) * ptr[x] + ax * ptr[x+1];
+                    float bottom = ( 1.f - ax ) * ptr[x+rowstep] + ax * ptr[x+rowstep+1];
+                    I[kRefineSize*y+x] = ( 1.f - ay ) * top + ay * bottom;
+                }
+            }
+            I -= I.mean();
+            float Inorm = sqrtf( ( I * I ).sum() );
+            if ( Inorm < 1e-3f ) return false;
+            
+            RefineArray r = I * ( Tnorm / Inorm ) - T;
+            float bx = ( gx * r ).sum();
+            float by = ( gy * r ).sum();
+            Eigen::Vector2f step( Hinv[0] * bx + Hinv[1] * by, Hinv[1] * bx + Hinv[2] * by );
+            
+            // the template moved by step, so the window moves the other way
+            delta -= step;
+            if ( fabsf( delta[0] ) > 1.f || fabsf( delta[1] ) > 1.f ) return false;
+            if ( step.squaredNorm() < 1e-4f ) break;
         }
         
-        patch->index = i;
+        return true;
+    }
+    
+    // templates are warped in batches, which keeps the sampling loop free of per-patch setup
+    static const size_t kTemplateBatch = 32;
+    
+    struct TemplateBatches
+    {
+        PatchSearchNCC *searcher;
+        size_t count;
+        std::atomic<int> nreused;
+    };
+    
+    // largest distance moved by a corner of the template between two warps into the source image
+    static float warpShift( const Eigen::Matrix3f &M0, const Eigen::Matrix3f &M1 )
+    {
+        float shift = 0;
+        for ( int y = 0; y < 8; y += 7 )
+        {
+            for ( int x = 0; x < 8; x += 7 )
+            {
+                Eigen::Vector3f p0 = M0 * Eigen::Vector3f( x, y, 1 );
+                Eigen::Vector3f p1 = M1 * Eigen::Vector3f( x, y, 1 );
+                shift = std::max( shift, ( p0.head<2>() / p0[2] - p1.head<2>() / p1[2] ).norm() );
+            }
+        }
+        return shift;
+    }
+    
+    // whether every sample of the template lies inside a square patch of the given size
+    static bool insidePatch( const Eigen::Matrix3f &M, int size )
+    {
+        for ( int y = 0; y < 8; y += 7 )
+        {
+            for ( int x = 0; x < 8; x += 7 )
+            {
+                Eigen::Vector3f p = M * Eigen::Vector3f( x, y, 1 );
+                if ( p[2] <= 0 ) return false;
+                float px = p[0] / p[2];
+                float py = p[1] / p[2];
+                if ( px < 0 || py < 0 || px >= size - 1 || py >= size - 1 ) return false;
+            }
+        }
+        return true;
+    }
+    
+    static void makeNCCTemplates( void *context, size_t b )
+    {
+        TemplateBatches *batches = (TemplateBatches*)context;
+        PatchSearchNCC *searcher = batches->searcher;
         
-        unsigned int A = computeSum( templatePtr );
-        unsigned int B = computeSumSq( templatePtr );
+        size_t begin = b * kTemplateBatch;
+        size_t end = std::min( begin + kTemplateBatch, batches->count );
         
-        float Af = A;
-        float Bf = B;
+        PatchWarp warps[kTemplateBatch];
+        size_t indices[kTemplateBatch];
+        int nwarps = 0;
+        int nreused = 0;
         
-        float Cf = 1.f / sqrtf( 64 * Bf - Af * Af );
-        *Aptr = Af;
-        *Cptr = Cf;
+        for ( size_t i = begin; i < end; i++ )
+        {
+            Patch *patch = *(searcher->begin+i);
+            
+            int level = 0;
+            float myscale = patch->scale;
+            while ( myscale > 3. ) {
+                if ( level == NLEVELS-1 ) break;
+                level++;
+                myscale /= 4.;
+            }
+            if ( myscale > 3. || myscale < 0.25 ) {
+                patch->shouldTrack = false;
+                continue;
+            }
+            float levelScale = powf( 2.f, -level );
+            Eigen::Matrix3f M = Sampler::warpMatrix( patch->warpcenter, patch->warp, levelScale, 8 );
+            
+            const cv::Mat *image = &patch->source->pyramid.levels[level].image;
+            
+            // keyframes added while tracking are not in the atlas, but keep their pyramids
+            const PatchAtlas::Entry *entry = NULL;
+            if ( searcher->atlas != NULL ) entry = searcher->atlas->find( patch->source_feature );
+            if ( entry != NULL )
+            {
+                // sample from the feature's patches instead; a patch too small for the template's footprint
+                // gives way to the next coarser level, where the footprint is half as wide
+                bool inside = false;
+                for ( ; level < NLEVELS; level++, levelScale *= .5f )
+                {
+                    M = Sampler::warpMatrix( patch->warpcenter, patch->warp, levelScale, 8 );
+                    Eigen::Matrix3f T;
+                    T <<
+                    1, 0, -entry->origins[level].x,
+                    0, 1, -entry->origins[level].y,
+                    0, 0, 1;
+                    M = T * M;
+                    inside = insidePatch( M, searcher->atlas->size() );
+                    if ( inside ) break;
+                }
+                if ( !inside ) {
+                    patch->shouldTrack = false;
+                    continue;
+                }
+                image = &entry->levels[level];
+            }
+            else if ( image->empty() )
+            {
+                patch->shouldTrack = false;
+                continue;
+            }
+            
+            if ( patch->cache == NULL )
+            {
+                patch->cache = new CachedTemplate[NLEVELS];
+                for ( int l = 0; l < NLEVELS; l++ ) patch->cache[l].source = NULL;
+            }
+            CachedTemplate &cached = patch->cache[searcher->level];
+            
+            // steady tracking barely changes the warp, so the template from an earlier frame will do
+            if ( cached.source == patch->source && cached.sourceLevel == level && warpShift( cached.M, M ) < searcher->templateReuseThreshold )
+            {
+                patch->index = i;
+                memcpy( searcher->templates + i*64, cached.patch, 64 );
+                searcher->templateA[i] = cached.A;
+                searcher->templateC[i] = cached.C;
+                memcpy( searcher->templateJacobians + i*2*kRefinePixels, cached.J, sizeof(cached.J) );
+                memcpy( searcher->templateHessians + i*3, cached.Hinv, sizeof(cached.Hinv) );
+                nreused++;
+                continue;
+            }
+            
+            cached.source = patch->source;
+            cached.sourceLevel = level;
+            cached.M = M;
+            
+            PatchWarp &warp = warps[nwarps];
+            warp.image = image;
+            warp.M = M;
+            warp.patch = cached.patch;
+            indices[nwarps] = i;
+            nwarps++;
+        }
+        
+        warpPatches( warps, nwarps );
+        
+        for ( int n = 0; n < nwarps; n++ )
+        {
+            size_t i = indices[n];
+            Patch *patch = *(searcher->begin+i);
+            CachedTemplate &cached = patch->cache[searcher->level];
+            
+            uchar *templatePtr = searcher->templates + i*64;
+            float *Aptr = searcher->templateA + i;
+            float *Cptr = searcher->templateC + i;
+            
+            patch->index = i;
+            memcpy( templatePtr, cached.patch, 64 );
+            
+            unsigned int A = computeSum( templatePtr );
+            unsigned int B = computeSumSq( templatePtr );
+            
+            float Af = A;
+            float Bf = B;
+            
+            float Cf = 1.f / sqrtf( 64 * Bf - Af * Af );
+            *Aptr = Af;
+            *Cptr = Cf;
+            cached.A = Af;
+            cached.C = Cf;
+            
+            // kept with the template, so that reusing it skips the gradients as well
+            computeTemplateJacobian( templatePtr, cached.J, cached.Hinv );
+            memcpy( searcher->templateJacobians + i*2*kRefinePixels, cached.J, sizeof(cached.J) );
+            memcpy( searcher->templateHessians + i*3, cached.Hinv, sizeof(cached.Hinv) );
+        }
+        
+        batches->nreused += nreused;
     }
     
     int PatchSearchNCC::makeTemplates( int count )
     {
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( count, queue, this, makeNCCTemplate );
-#else
-        for ( int i = 0; i < count; i++ ) {
-            warpTimer.start();
-            makeNCCTemplate( this, i );
-            warpTimer.stop();
-        }
-#endif
+        warpTimer.start();
+        TemplateBatches batches;
+        batches.searcher = this;
+        batches.count = count;
+        batches.nreused = 0;
+        parallel_for( ( count + kTemplateBatch - 1 ) / kTemplateBatch, &batches, makeNCCTemplates );
+        nreused = batches.nreused;
+        warpTimer.stop();
         
         int newcount = 0;
         for ( int i = 0; i < count; i++ )
@@ -111,12 +348,8 @@ namespace vrlt
         return newcount;
     }
     
-    static inline float getNCC( uchar *targetPtr, uchar *templatePtr, float templateA, float templateC )
+    static inline float getNCC( unsigned int A, unsigned int B, unsigned int D, float templateA, float templateC )
     {
-        unsigned int A = computeSum( targetPtr );
-        unsigned int B = computeSumSq( targetPtr );
-        unsigned int D = computeDotProduct( targetPtr, templatePtr );
-        
         float Af = A;
         float Bf = B;
         float Cf = 1.f / sqrtf( 64 * Bf - Af * Af );
@@ -125,18 +358,22 @@ namespace vrlt
         return score;
     }
     
+    static inline float getNCC( uchar *targetPtr, uchar *templatePtr, float templateA, float templateC )
+    {
+        unsigned int A = computeSum( targetPtr );
+        unsigned int B = computeSumSq( targetPtr );
+        unsigned int D = computeDotProduct( targetPtr, templatePtr );
+        
+        return getNCC( A, B, D, templateA, templateC );
+    }
+    
     static inline float getNCC( uchar *targetPtr, int targetRowStep, uchar *templatePtr, float templateA, float templateC )
     {
         unsigned int A = computeSum( targetPtr, targetRowStep );
         unsigned int B = computeSumSq( targetPtr, targetRowStep );
         unsigned int D = computeDotProduct( targetPtr, targetRowStep, templatePtr );
         
-        float Af = A;
-        float Bf = B;
-        float Cf = 1.f / sqrtf( 64 * Bf - Af * Af );
-        float Df = D;
-        float score = ( 64 * Df - Af * templateA ) * Cf * templateC;
-        return score;
+        return getNCC( A, B, D, templateA, templateC );
     }
     
     void searchNCCTemplate( void *context, size_t i )
@@ -152,16 +389,8 @@ namespace vrlt
         float *Aptr = searcher->templateA + index;
         float *Cptr = searcher->templateC + index;
         
-        uchar *targetPtr;
-        int targetRowStep;
-        
-        if ( searcher->subsample ) {
-            targetPtr = searcher->targets + index*64;
-            targetRowStep = 8;
-        } else {
-            targetPtr = new uchar[1];
-            targetRowStep = w;
-        }
+        uchar *targetPtr = searcher->targets + index*64;
+        int targetRowStep = ( searcher->subsample ) ? 8 : w;
         
         cv::Mat templatePatch( cv::Size(8,8), CV_8UC1, templatePtr );
         cv::Mat targetPatch( cv::Size(8,8), CV_8UC1, targetPtr );
@@ -183,24 +412,36 @@ namespace vrlt
         int lower = 0;
         int upper = 8;
         
+        // when every window passes the bounds check below, compute the statistics of all 64 in one pass
+        unsigned int sums[64], sumsqs[64], dots[64];
+        bool wholeRegion = false;
+        if ( !searcher->subsample && in_image( patch->target->image.size(), ir_origin ) && in_image( patch->target->image.size(), ir_origin + cv::Point2i(15,15) ) )
+        {
+            computeWindowStatistics( patch->target->image.ptr( ir_origin.y ) + ir_origin.x, w, templatePtr, sums, sumsqs, dots );
+            wholeRegion = true;
+        }
+        
         for ( int y = lower; y < upper; y++ ) {
             for ( int x = lower; x < upper; x++ ) {
-                if ( searcher->subsample ) {
+                float score;
+                if ( wholeRegion ) {
+                    score = getNCC( sums[8*y+x], sumsqs[8*y+x], dots[8*y+x], (*Aptr), (*Cptr) );
+                } else if ( searcher->subsample ) {
                     Eigen::Vector2f pt;
                     pt[0] = center[0] + x;
                     pt[1] = center[1] + y;
                     bool good = patch->sampler.samplePatch( patch->target->image, pt, targetPatch );
                     if ( !good ) continue;
+                    score = getNCC( targetPtr, targetRowStep, templatePtr, (*Aptr), (*Cptr) );
                 } else {
                     cv::Point2i my_origin = ir_origin + cv::Point2i(x,y);
                     if ( !in_image( patch->target->image.size(), my_origin ) ) continue;
                     if ( !in_image( patch->target->image.size(), my_origin + cv::Point2i(targetPatch.size().width,targetPatch.size().height) ) ) continue;
                     
                     targetPtr = patch->target->image.ptr( my_origin.y ) + my_origin.x;
+                    score = getNCC( targetPtr, targetRowStep, templatePtr, (*Aptr), (*Cptr) );
                 }
                 
-                float score = getNCC( targetPtr, targetRowStep, templatePtr, (*Aptr), (*Cptr) );
-                
                 if ( std::isnan( score ) ) score = 0.f;
                 scores(y,x) = score;
                 
@@ -228,8 +469,17 @@ namespace vrlt
             patch->targetPos[0] = center[0] + bestLoc.x;
             patch->targetPos[1] = center[1] + bestLoc.y;
         } else {
-            patch->targetPos[0] = (ir_origin.x + ir_offset.x) + bestLoc.x;
-            patch->targetPos[1] = (ir_origin.y + ir_offset.y) + bestLoc.y;
+            // the window at origin matches the template centered 3.5 pixels in
+            cv::Point2i origin = ir_origin + bestLoc;
+            patch->targetPos[0] = origin.x + offset[0];
+            patch->targetPos[1] = origin.y + offset[1];
+            
+            Eigen::Vector2f delta;
+            if ( searcher->refine && refinePosition( patch->target->image, origin, templatePtr, searcher->templateJacobians + index*2*kRefinePixels,
+                                                     searcher->templateHessians + index*3, delta ) )
+            {
+                patch->targetPos += delta;
+            }
         }
         
         
@@ -238,16 +488,9 @@ namespace vrlt
     
     int PatchSearchNCC::doSearch( int count )
     {
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( count, queue, this, searchNCCTemplate );
-#else
-        for ( int i = 0; i < count; i++ ) {
-            searchTimer.start();
-            searchNCCTemplate( this, i );
-            searchTimer.stop();
-        }
-#endif
+        searchTimer.start();
+        parallel_for( count, this, searchNCCTemplate );
+        searchTimer.stop();
         
         int newcount = 0;
         for ( int i = 0; i < count; i++ )
@@ -21,11 +21,16 @@
 namespace vrlt
 {
     Patch::Patch( Point *_point )
-    : point( _point ), target( NULL ), source( NULL ), targetScore( INFINITY )
+    : point( _point ), target( NULL ), source( NULL ), cache( NULL ), targetScore( INFINITY )
     {
         
     }
     
+    Patch::~Patch()
+    {
+        delete [] cache;
+    }
+    
     static inline float scaleFromWarp( const Eigen::Matrix3f &warp )
     { 
         float det = warp(0,0) * warp(1,1) - warp(0,1) * warp(1,0);
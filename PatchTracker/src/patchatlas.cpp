@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: patchatlas.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/patchatlas.h>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace vrlt
+{
+    static const char kAtlasMagic[8] = { 'V', 'R', 'L', 'T', 'A', 'T', 'L', '1' };
+    
+    PatchAtlas::PatchAtlas()
+    : patchSize( 0 )
+    {
+        
+    }
+    
+    void PatchAtlas::allocate( size_t n )
+    {
+        const size_t levelBytes = patchSize * patchSize;
+        
+        entries.resize( n );
+        pixels.assign( n * NLEVELS * levelBytes, 0 );
+        for ( size_t i = 0; i < n; i++ )
+        {
+            for ( int l = 0; l < NLEVELS; l++ )
+            {
+                unsigned char *ptr = &pixels[0] + ( i * NLEVELS + l ) * levelBytes;
+                entries[i].levels[l] = cv::Mat( patchSize, patchSize, CV_8UC1, ptr );
+            }
+        }
+        
+        lookup.clear();
+        for ( size_t i = 0; i < n; i++ ) lookup[features[i]] = i;
+    }
+    
+    void PatchAtlas::make( Node *root, int size )
+    {
+        patchSize = size;
+        
+        features.clear();
+        ElementList::iterator it;
+        for ( it = root->points.begin(); it != root->points.end(); it++ )
+        {
+            Point *point = (Point *)it->second;
+            if ( point->track == NULL ) continue;
+            
+            ElementList::iterator fit;
+            for ( fit = point->track->features.begin(); fit != point->track->features.end(); fit++ )
+            {
+                Feature *feature = (Feature *)fit->second;
+                if ( feature->camera != NULL ) features.push_back( feature );
+            }
+        }
+        
+        allocate( features.size() );
+        
+        for ( size_t i = 0; i < features.size(); i++ )
+        {
+            const Feature *feature = features[i];
+            Entry &entry = entries[i];
+            
+            for ( int l = 0; l < NLEVELS; l++ )
+            {
+                const cv::Mat &image = feature->camera->pyramid.levels[l].image;
+                
+                // same pixel-center convention as the tracker's level calibrations
+                float levelScale = powf( 2.f, -l );
+                float x = ( feature->location[0] + .5f ) * levelScale - .5f;
+                float y = ( feature->location[1] + .5f ) * levelScale - .5f;
+                entry.origins[l] = cv::Point2i( (int)floorf( x + .5f ) - patchSize / 2, (int)floorf( y + .5f ) - patchSize / 2 );
+                
+                // pixels outside the image stay zero, as warpPatch() would sample them
+                for ( int r = 0; r < patchSize; r++ )
+                {
+                    int sy = entry.origins[l].y + r;
+                    if ( sy < 0 || sy >= image.rows ) continue;
+                    
+                    unsigned char *dst = entry.levels[l].ptr( r );
+                    const unsigned char *src = image.ptr( sy );
+                    for ( int c = 0; c < patchSize; c++ )
+                    {
+                        int sx = entry.origins[l].x + c;
+                        if ( sx >= 0 && sx < image.cols ) dst[c] = src[sx];
+                    }
+                }
+            }
+        }
+    }
+    
+    bool PatchAtlas::write( const std::string &path ) const
+    {
+        FILE *f = fopen( path.c_str(), "wb" );
+        if ( f == NULL ) return false;
+        
+        int nlevels = NLEVELS;
+        unsigned int n = (unsigned int)features.size();
+        fwrite( kAtlasMagic, 1, sizeof(kAtlasMagic), f );
+        fwrite( &patchSize, sizeof(int), 1, f );
+        fwrite( &nlevels, sizeof(int), 1, f );
+        fwrite( &n, sizeof(unsigned int), 1, f );
+        
+        // names first, so that the pixels can be read in one go
+        for ( size_t i = 0; i < features.size(); i++ )
+        {
+            const std::string &cameraname = features[i]->camera->name;
+            const std::string &featurename = features[i]->name;
+            int length = (int)cameraname.size();
+            fwrite( &length, sizeof(int), 1, f );
+            fwrite( cameraname.c_str(), 1, length, f );
+            length = (int)featurename.size();
+            fwrite( &length, sizeof(int), 1, f );
+            fwrite( featurename.c_str(), 1, length, f );
+            
+            for ( int l = 0; l < NLEVELS; l++ )
+            {
+                int origin[2] = { entries[i].origins[l].x, entries[i].origins[l].y };
+                fwrite( origin, sizeof(int), 2, f );
+            }
+        }
+        
+        if ( !pixels.empty() ) fwrite( &pixels[0], 1, pixels.size(), f );
+        
+        bool good = !ferror( f );
+        fclose( f );
+        return good;
+    }
+    
+    static bool readString( FILE *f, std::string &str )
+    {
+        int length = 0;
+        if ( fread( &length, sizeof(int), 1, f ) != 1 || length < 0 || length > 4096 ) return false;
+        str.resize( length );
+        return ( length == 0 || fread( &str[0], 1, length, f ) == (size_t)length );
+    }
+    
+    bool PatchAtlas::read( const std::string &path, Reconstruction &r )
+    {
+        FILE *f = fopen( path.c_str(), "rb" );
+        if ( f == NULL ) return false;
+        
+        // the header is parsed into locals, so that a bad file leaves the atlas as it was
+        char magic[8];
+        int size = 0;
+        int nlevels = 0;
+        unsigned int n = 0;
+        bool good = ( fread( magic, 1, sizeof(magic), f ) == sizeof(magic) && memcmp( magic, kAtlasMagic, sizeof(magic) ) == 0 );
+        good = good && fread( &size, sizeof(int), 1, f ) == 1 && size > 0 && size <= 256;
+        good = good && fread( &nlevels, sizeof(int), 1, f ) == 1 && nlevels == NLEVELS;
+        good = good && fread( &n, sizeof(unsigned int), 1, f ) == 1;
+        if ( !good )
+        {
+            std::cerr << "error: " << path << " is not a patch atlas with " << NLEVELS << " levels\n";
+            fclose( f );
+            return false;
+        }
+        
+        // each entry takes at least its two string lengths, its origins and its pixels, so a count the rest of the
+        // file cannot hold is corrupt and must not size the buffers below
+        long start = ftell( f );
+        fseek( f, 0, SEEK_END );
+        long remaining = ftell( f ) - start;
+        fseek( f, start, SEEK_SET );
+        const size_t minEntryBytes = ( 2 + 2*NLEVELS ) * sizeof(int) + NLEVELS * size * size;
+        if ( start < 0 || remaining < 0 || n > (unsigned long)remaining / minEntryBytes )
+        {
+            std::cerr << "error: patch atlas " << path << " claims " << n << " patches, more than the file holds\n";
+            fclose( f );
+            return false;
+        }
+        
+        // entries whose feature is missing from the reconstruction are read, then dropped
+        std::vector<const Feature*> allFeatures( n, (const Feature*)NULL );
+        std::vector<cv::Point2i> allOrigins( n * NLEVELS );
+        for ( unsigned int i = 0; i < n && good; i++ )
+        {
+            std::string cameraname, featurename;
+            good = readString( f, cameraname ) && readString( f, featurename );
+            
+            int origins[2*NLEVELS];
+            good = good && fread( origins, sizeof(int), 2*NLEVELS, f ) == 2*NLEVELS;
+            for ( int l = 0; l < NLEVELS; l++ ) allOrigins[i*NLEVELS+l] = cv::Point2i( origins[2*l], origins[2*l+1] );
+            
+            ElementList::iterator cit = r.cameras.find( cameraname );
+            if ( cit == r.cameras.end() ) continue;
+            Camera *camera = (Camera *)cit->second;
+            ElementList::iterator fit = camera->features.find( featurename );
+            if ( fit == camera->features.end() ) continue;
+            allFeatures[i] = (Feature *)fit->second;
+        }
+        
+        const size_t entryBytes = NLEVELS * size * size;
+        std::vector<unsigned char> allPixels( n * entryBytes );
+        good = good && ( n == 0 || fread( &allPixels[0], 1, allPixels.size(), f ) == allPixels.size() );
+        fclose( f );
+        if ( !good )
+        {
+            std::cerr << "error: patch atlas " << path << " is truncated\n";
+            return false;
+        }
+        
+        patchSize = size;
+        features.clear();
+        std::vector<size_t> kept;
+        for ( unsigned int i = 0; i < n; i++ )
+        {
+            if ( allFeatures[i] == NULL ) continue;
+            features.push_back( allFeatures[i] );
+            kept.push_back( i );
+        }
+        if ( kept.size() < n ) std::cerr << "warning: " << n - kept.size() << " patches of " << path << " have no feature in the reconstruction\n";
+        
+        allocate( kept.size() );
+        for ( size_t i = 0; i < kept.size(); i++ )
+        {
+            memcpy( &pixels[i * entryBytes], &allPixels[kept[i] * entryBytes], entryBytes );
+            for ( int l = 0; l < NLEVELS; l++ ) entries[i].origins[l] = allOrigins[kept[i]*NLEVELS+l];
+        }
+        
+        return true;
+    }
+    
+    const PatchAtlas::Entry * PatchAtlas::find( const Feature *feature ) const
+    {
+        std::unordered_map<const Feature*,size_t>::const_iterator it = lookup.find( feature );
+        if ( it == lookup.end() ) return NULL;
+        return &entries[it->second];
+    }
+}
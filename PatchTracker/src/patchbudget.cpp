@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: patchbudget.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/patchbudget.h>
+
+#include <algorithm>
+
+namespace vrlt
+{
+    PatchBudget::PatchBudget()
+    : frameTime( 0 ), minPatches( 256 ), smoothing( 0.2 )
+    {
+        reset();
+    }
+    
+    void PatchBudget::reset()
+    {
+        have_fixed = false;
+        have_patch = false;
+        fixedCost = 0;
+        patchCost = 0;
+    }
+    
+    void PatchBudget::plan( int maxpatches, int firstlevel, int lastlevel, int &npatches, int &startlevel ) const
+    {
+        npatches = maxpatches;
+        startlevel = firstlevel;
+        
+        // nothing to go on until a frame has been searched
+        if ( frameTime <= 0 || !have_patch ) return;
+        
+        double available = std::max( 0., frameTime - fixedCost );
+        for ( ; ; )
+        {
+            int nlevels = startlevel - lastlevel + 1;
+            double affordable = available / ( nlevels * patchCost );
+            npatches = (int)std::min( (double)maxpatches, affordable );
+            
+            // fewer levels leave more time for patches at the finest level, which decide the accuracy
+            if ( npatches >= minPatches || startlevel == lastlevel ) break;
+            startlevel--;
+        }
+        
+        npatches = std::max( npatches, std::min( minPatches, maxpatches ) );
+    }
+    
+    void PatchBudget::recordFixed( double seconds )
+    {
+        fixedCost = ( have_fixed ) ? ( 1. - smoothing ) * fixedCost + smoothing * seconds : seconds;
+        have_fixed = true;
+    }
+    
+    void PatchBudget::recordLevel( int count, double seconds )
+    {
+        if ( count <= 0 ) return;
+        double cost = seconds / count;
+        patchCost = ( have_patch ) ? ( 1. - smoothing ) * patchCost + smoothing * cost : cost;
+        have_patch = true;
+    }
+}
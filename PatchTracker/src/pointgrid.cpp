@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: pointgrid.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/pointgrid.h>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+#include <cmath>
+
+namespace vrlt
+{
+    // enough points per cell that the cell tests cost little next to the point tests they save
+    static const size_t kPointsPerCell = 32;
+    static const int kMaxCellsPerAxis = 256;
+    
+    void PointGrid::build( const std::vector<Eigen::Vector4d> &positions )
+    {
+        cells.clear();
+        pointIndices.clear();
+        unbinned.clear();
+        
+        std::vector<size_t> binned;
+        std::vector<Eigen::Vector3d> points( positions.size() );
+        Eigen::Vector3d lower = Eigen::Vector3d::Constant( INFINITY );
+        Eigen::Vector3d upper = Eigen::Vector3d::Constant( -INFINITY );
+        for ( size_t i = 0; i < positions.size(); i++ )
+        {
+            const Eigen::Vector4d &X = positions[i];
+            if ( !( X[3] > 0 ) || !X.allFinite() )
+            {
+                unbinned.push_back( i );
+                continue;
+            }
+            points[i] = X.head(3) / X[3];
+            lower = lower.cwiseMin( points[i] );
+            upper = upper.cwiseMax( points[i] );
+            binned.push_back( i );
+        }
+        if ( binned.empty() ) return;
+        
+        // choose the cell size so that the grid has about one cell per kPointsPerCell points;
+        // flat or elongated maps get fewer cells along their thin axes
+        Eigen::Vector3d extent = ( upper - lower ).cwiseMax( 1e-9 );
+        double target = std::max( (double)binned.size() / kPointsPerCell, 1. );
+        double cellsize = extent.maxCoeff() / std::cbrt( target );
+        Eigen::Vector3i dims;
+        for ( int iter = 0; iter < 32; iter++ )
+        {
+            for ( int k = 0; k < 3; k++ ) dims[k] = std::min( kMaxCellsPerAxis, std::max( 1, (int)ceil( extent[k] / cellsize ) ) );
+            if ( (double)dims[0] * dims[1] * dims[2] >= target / 2 ) break;
+            cellsize *= 0.8;
+        }
+        
+        // counting sort of the points by cell
+        std::vector<size_t> cellOf( binned.size() );
+        std::vector<size_t> counts( (size_t)dims[0] * dims[1] * dims[2] + 1, 0 );
+        for ( size_t j = 0; j < binned.size(); j++ )
+        {
+            Eigen::Vector3d rel = ( points[binned[j]] - lower ).cwiseQuotient( extent );
+            size_t cell = 0;
+            for ( int k = 2; k >= 0; k-- )
+            {
+                int c = std::min( dims[k] - 1, std::max( 0, (int)( rel[k] * dims[k] ) ) );
+                cell = cell * dims[k] + c;
+            }
+            cellOf[j] = cell;
+            counts[cell+1]++;
+        }
+        for ( size_t c = 1; c < counts.size(); c++ ) counts[c] += counts[c-1];
+        
+        pointIndices.resize( binned.size() );
+        std::vector<size_t> next( counts.begin(), counts.end() - 1 );
+        for ( size_t j = 0; j < binned.size(); j++ ) pointIndices[next[cellOf[j]]++] = binned[j];
+        
+        for ( size_t c = 0; c + 1 < counts.size(); c++ )
+        {
+            if ( counts[c] == counts[c+1] ) continue;
+            
+            Cell cell;
+            cell.begin = counts[c];
+            cell.end = counts[c+1];
+            cell.lower = cell.upper = points[pointIndices[cell.begin]];
+            for ( size_t j = cell.begin + 1; j < cell.end; j++ )
+            {
+                cell.lower = cell.lower.cwiseMin( points[pointIndices[j]] );
+                cell.upper = cell.upper.cwiseMax( points[pointIndices[j]] );
+            }
+            cells.push_back( cell );
+        }
+    }
+    
+    void PointGrid::cull( const Eigen::Matrix<float,3,4> &poseMatrix, float f, float u, float v, const cv::Size &size, std::vector<size_t> &indices ) const
+    {
+        indices.clear();
+        indices.insert( indices.end(), unbinned.begin(), unbinned.end() );
+        
+        // Half-spaces through the camera center, in camera coordinates, containing every point which the tracker
+        // accepts: Z >= 0 and -1 < f X/Z + u < width, and likewise for y.  A pixel of slack on each side of the image
+        // covers rounding in the per-point test.
+        Eigen::Vector3d planes[5];
+        planes[0] << 0, 0, 1;
+        planes[1] << f, 0, u + 2;
+        planes[2] << -f, 0, size.width - u + 1;
+        planes[3] << 0, f, v + 2;
+        planes[4] << 0, -f, size.height - v + 1;
+        
+        // move the planes to world coordinates: n . ( R X + t ) = ( R^T n ) . X + n . t
+        Eigen::Matrix3d R = poseMatrix.block<3,3>(0,0).cast<double>();
+        Eigen::Vector3d t = poseMatrix.col(3).cast<double>();
+        Eigen::Vector3d normals[5];
+        double offsets[5];
+        for ( int p = 0; p < 5; p++ )
+        {
+            normals[p] = R.transpose() * planes[p];
+            offsets[p] = planes[p].dot( t );
+        }
+        
+        for ( size_t c = 0; c < cells.size(); c++ )
+        {
+            const Cell &cell = cells[c];
+            
+            bool outside = false;
+            for ( int p = 0; p < 5 && !outside; p++ )
+            {
+                // corner of the box furthest along the normal
+                double d = offsets[p];
+                for ( int k = 0; k < 3; k++ ) d += normals[p][k] * ( ( normals[p][k] > 0 ) ? cell.upper[k] : cell.lower[k] );
+                if ( d < 0 ) outside = true;
+            }
+            if ( outside ) continue;
+            
+            indices.insert( indices.end(), pointIndices.begin() + cell.begin, pointIndices.begin() + cell.end );
+        }
+        
+        std::sort( indices.begin(), indices.end() );
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: pointstore.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/pointstore.h>
+
+namespace vrlt
+{
+    void PointStore::build( const std::vector<Point*> &_points )
+    {
+        points = _points;
+        
+        size_t n = points.size();
+        x.resize( n );
+        y.resize( n );
+        z.resize( n );
+        w.resize( n );
+        nx.resize( n );
+        ny.resize( n );
+        nz.resize( n );
+        tracked.assign( n, 0 );
+        u.assign( n, 0.f );
+        v.assign( n, 0.f );
+        trackedIndices.clear();
+        
+        for ( size_t i = 0; i < n; i++ )
+        {
+            Point *point = points[i];
+            x[i] = point->position[0];
+            y[i] = point->position[1];
+            z[i] = point->position[2];
+            w[i] = point->position[3];
+            nx[i] = point->normal[0];
+            ny[i] = point->normal[1];
+            nz[i] = point->normal[2];
+        }
+    }
+    
+    void PointStore::clearTracked()
+    {
+        for ( size_t j = 0; j < trackedIndices.size(); j++ ) tracked[trackedIndices[j]] = 0;
+        trackedIndices.clear();
+    }
+    
+    void PointStore::setTracked( size_t i )
+    {
+        if ( tracked[i] ) return;
+        tracked[i] = 1;
+        trackedIndices.push_back( i );
+    }
+}
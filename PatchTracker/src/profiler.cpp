@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: profiler.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/profiler.h>
+
+#include <cstdio>
+
+namespace vrlt
+{
+    Profiler::Scope::Scope( Profiler &_profiler, const char *_stage, int _level, int _count )
+    : count( _count ), profiler( _profiler ), stage( _stage ), level( _level ), start( 0 )
+    {
+        if ( profiler.enabled ) start = Timer::getTime();
+    }
+    
+    Profiler::Scope::~Scope()
+    {
+        if ( profiler.enabled ) profiler.record( stage, level, count, start, Timer::getTime() );
+    }
+    
+    Profiler::Profiler()
+    : enabled( false ), origin( Timer::getTime() ), frame( -1 )
+    {
+        
+    }
+    
+    void Profiler::record( const char *stage, int level, int count, uint64_t start, uint64_t end )
+    {
+        if ( !enabled ) return;
+        
+        Event event;
+        event.stage = stage;
+        event.frame = frame;
+        event.level = level;
+        event.count = count;
+        event.start = ( start > origin ) ? start - origin : 0;
+        event.duration = ( end > start ) ? end - start : 0;
+        events.push_back( event );
+    }
+    
+    void Profiler::clear()
+    {
+        events.clear();
+        frame = -1;
+    }
+    
+    bool Profiler::writeCSV( const std::string &path ) const
+    {
+        FILE *f = fopen( path.c_str(), "w" );
+        if ( f == NULL ) return false;
+        
+        fprintf( f, "frame,level,stage,count,start_us,duration_us\n" );
+        for ( size_t i = 0; i < events.size(); i++ )
+        {
+            const Event &event = events[i];
+            fprintf( f, "%d,%d,%s,%d,%.3f,%.3f\n", event.frame, event.level, event.stage, event.count, event.start * 1e-3, event.duration * 1e-3 );
+        }
+        
+        fclose( f );
+        return true;
+    }
+    
+    bool Profiler::writeTrace( const std::string &path ) const
+    {
+        FILE *f = fopen( path.c_str(), "w" );
+        if ( f == NULL ) return false;
+        
+        fprintf( f, "{\"traceEvents\":[\n" );
+        for ( size_t i = 0; i < events.size(); i++ )
+        {
+            const Event &event = events[i];
+            fprintf( f, "{\"name\":\"%s\",\"cat\":\"tracker\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,"
+                        "\"args\":{\"frame\":%d,\"level\":%d,\"count\":%d}}%s\n",
+                     event.stage, event.start * 1e-3, event.duration * 1e-3, event.frame, event.level, event.count,
+                     ( i + 1 < events.size() ) ? "," : "" );
+        }
+        fprintf( f, "],\"displayTimeUnit\":\"ms\"}\n" );
+        
+        fclose( f );
+        return true;
+    }
+}
@@ -46,77 +46,71 @@ namespace vrlt
       return ( ksq / 6. ) * ( 1. - pow( 1. - (residsq/ksq), 3. ) );
     }
 
+    // projects the packed points with the pose; plain array expressions, which Eigen vectorizes
+    void RobustLeastSq::computeResiduals( const Sophus::SE3f &pose, float f, const Eigen::Vector2f &center )
+    {
+        Eigen::Matrix3f R = pose.rotationMatrix();
+        Eigen::Vector3f t = pose.translation();
+        
+        invZ = ( R(2,0) * X + R(2,1) * Y + R(2,2) * Z + t[2] ).inverse();
+        xn = ( R(0,0) * X + R(0,1) * Y + R(0,2) * Z + t[0] ) * invZ;
+        yn = ( R(1,0) * X + R(1,1) * Y + R(1,2) * Z + t[1] ) * invZ;
+        
+        ex = u - ( f * xn + center[0] );
+        ey = v - ( f * yn + center[1] );
+        residualsqs = ex.square() + ey.square();
+    }
+    
     bool RobustLeastSq::updatePose( Camera *camera_in, int iter, float eps )
     {
-        Eigen::Matrix<float,6,6> FtF = Eigen::Matrix<float,6,6>::Zero();
-        Eigen::Matrix<float,6,1> Fte = Eigen::Matrix<float,6,1>::Zero();
-
         Sophus::SE3f pose( camera_in->node->pose.cast<float>() );
         float f = camera_in->calibration->focal;
         Eigen::Vector2f center = camera_in->calibration->center.cast<float>();
-
-        ElementList::iterator it;
+        
+        const int n = (int)points.size();
+        
+        computeResiduals( pose, f, center );
 
         if ( iter < niter/2 )
         {
-            std::vector<float> residualsqs;
-            for ( it = root->points.begin(); it != root->points.end(); it++ )
-            {
-                Point *point = (Point*)it->second;
-                if ( !point->tracked ) continue;
-
-                Eigen::Vector3f PX = pose * (point->position.head(3).cast<float>()/(float)point->position[3]);
-
-                Eigen::Vector2f x = f * project(PX) + center;
-                Eigen::Vector2f e = point->location - x;
-                
-                residualsqs.push_back( e.dot(e) );
-            }
-            if ( residualsqs.size() > 0 ) {
-                float var = computeRobustStdDev( residualsqs );
+            if ( n > 0 ) {
+                std::vector<float> residualsqvec( residualsqs.data(), residualsqs.data() + n );
+                float var = computeRobustStdDev( residualsqvec );
                 ksq = computeTukeyParamSq( var );
             }
         }
+        
+        weights = ( residualsqs > ksq ).select( Eigen::ArrayXf::Zero( n ), ( 1.f - residualsqs / ksq ).square() );
+
+        // Jacobian of the projection with respect to the update exp(d)*pose; the rows of the x residuals are stacked
+        // above those of the y residuals
+        Eigen::ArrayXf fz = f * invZ;
+        Eigen::Matrix<float,Eigen::Dynamic,6> J( 2*n, 6 );
+        J.col(0) << fz.matrix(), Eigen::VectorXf::Zero( n );
+        J.col(1) << Eigen::VectorXf::Zero( n ), fz.matrix();
+        J.col(2) << ( -fz * xn ).matrix(), ( -fz * yn ).matrix();
+        J.col(3) << ( -f * xn * yn ).matrix(), ( -f * ( 1.f + yn.square() ) ).matrix();
+        J.col(4) << ( f * ( 1.f + xn.square() ) ).matrix(), ( f * xn * yn ).matrix();
+        J.col(5) << ( -f * yn ).matrix(), ( f * xn ).matrix();
+        
+        Eigen::VectorXf e( 2*n );
+        e << ex.matrix(), ey.matrix();
+        Eigen::VectorXf w2( 2*n );
+        w2 << weights.matrix(), weights.matrix();
+        
+        Eigen::Matrix<float,Eigen::Dynamic,6> WJ = w2.asDiagonal() * J;
+        Eigen::Matrix<float,6,6> FtF = J.transpose() * WJ;
+        Eigen::Matrix<float,6,1> Fte = WJ.transpose() * e;
 
         float toterr = 0.f;
-
-        std::vector<float> weights( root->points.size() );
-
-        int i = 0;
-        for ( it = root->points.begin(); it != root->points.end(); it++,i++ )
-        {
-            Point *point = (Point*)it->second;
-            if ( !point->tracked ) continue;
-
-            Eigen::Vector3f PX = pose * (point->position.head(3).cast<float>()/(float)point->position[3]);
-
-            Eigen::Matrix<float,2,3> A;
-            A << PX[2], 0, -PX[0],
-                0, PX[2], -PX[1];
-            A *= f / (PX[2] * PX[2]);
-
-            Eigen::Matrix<float,3,6> J;
-            
-            for ( int m = 0; m < 6; m++ ) {
-                J.col(m) = ( Sophus::SE3f::generator( m ) * unproject(PX) ).head(3);
-            }
-            
-            Eigen::Matrix<float,2,6> Fn = A * J;
-
-            Eigen::Vector2f x = f * project(PX) + center;
-
-            Eigen::Vector2f pos = point->location;
-            Eigen::Vector2f e = pos - x;
-
-            float residsq = e.dot(e);
-            float w = computeTukeyWeight( ksq, residsq );
-            weights[i] = w;
-
-            FtF += Fn.transpose() * ( weights[i] * Fn );
-            Fte += Fn.transpose() * ( weights[i] * e );
-
-            toterr += computeTukeyObjectiveFunction( ksq, residsq );
-        }
+        for ( int i = 0; i < n; i++ ) toterr += computeTukeyObjectiveFunction( ksq, residualsqs[i] );
+        
+        // keep the undamped normal equations for the covariance
+        lastFtF = FtF;
+        lastWeightedErr = ( weights * residualsqs ).sum();
+        lastWeightSum = weights.sum();
+        lastInlierErr = ( weights > 0 ).select( residualsqs, 0.f ).sum();
+        lastNumInliers = ( weights > 0 ).count();
 
         float avg_diag = 0;
         for ( int i = 0; i < 6; i++ ) {
@@ -132,29 +126,16 @@ namespace vrlt
         Sophus::SE3f newpose = Sophus::SE3f::exp( soln ) * pose;
 
         // calculate new error
+        computeResiduals( newpose, f, center );
         float newerr = 0;
-        i = 0;
-        for ( it = root->points.begin(); it != root->points.end(); it++,i++ )
-        {
-            Point *point = (Point*)it->second;
-            if ( !point->tracked ) continue;
+        for ( int i = 0; i < n; i++ ) newerr += computeTukeyObjectiveFunction( ksq, residualsqs[i] );
 
-            Eigen::Vector3f PX = newpose * (point->position.head(3).cast<float>()/(float)point->position[3]);
-
-            Eigen::Vector2f x = f * project(PX) + center;
-
-            Eigen::Vector2f pos = point->location;
-            Eigen::Vector2f e = pos - x;
-
-//            if ( weights[i] == 0 ) {
-//                point->tracked = false;
-//            }
-
-            float residsq = e.dot(e);
-            newerr += computeTukeyObjectiveFunction( ksq, residsq );
-
-            if ( iter == niter-1 ) {
-                point->tracked = ( weights[i] > 0 );
+        if ( iter == niter-1 ) {
+            for ( int i = 0; i < n; i++ )
+            {
+                bool tracked = ( weights[i] > 0 );
+                points[i]->tracked = tracked;
+                if ( store != NULL ) store->tracked[storeIndices[i]] = tracked;
             }
         }
 
@@ -165,17 +146,98 @@ namespace vrlt
 
         return false;
     }
-
+    
     bool RobustLeastSq::run( Camera *camera_in )
+    {
+        store = NULL;
+        points.clear();
+        storeIndices.clear();
+        
+        ElementList::iterator it;
+        for ( it = root->points.begin(); it != root->points.end(); it++ )
+        {
+            Point *point = (Point*)it->second;
+            if ( point->tracked ) points.push_back( point );
+        }
+        
+        const int n = (int)points.size();
+        X.resize( n );
+        Y.resize( n );
+        Z.resize( n );
+        u.resize( n );
+        v.resize( n );
+        for ( int i = 0; i < n; i++ )
+        {
+            Eigen::Vector3f PX = points[i]->position.head(3).cast<float>()/(float)points[i]->position[3];
+            X[i] = PX[0];
+            Y[i] = PX[1];
+            Z[i] = PX[2];
+            u[i] = points[i]->location[0];
+            v[i] = points[i]->location[1];
+        }
+        
+        return solve( camera_in );
+    }
+    
+    bool RobustLeastSq::run( Camera *camera_in, PointStore &_store )
+    {
+        store = &_store;
+        points.clear();
+        storeIndices.clear();
+        
+        for ( size_t j = 0; j < store->trackedIndices.size(); j++ )
+        {
+            size_t index = store->trackedIndices[j];
+            if ( !store->tracked[index] ) continue;
+            storeIndices.push_back( index );
+            points.push_back( store->points[index] );
+        }
+        
+        const int n = (int)points.size();
+        X.resize( n );
+        Y.resize( n );
+        Z.resize( n );
+        u.resize( n );
+        v.resize( n );
+        for ( int i = 0; i < n; i++ )
+        {
+            size_t index = storeIndices[i];
+            X[i] = store->x[index] / store->w[index];
+            Y[i] = store->y[index] / store->w[index];
+            Z[i] = store->z[index] / store->w[index];
+            u[i] = store->u[index];
+            v[i] = store->v[index];
+        }
+        
+        bool good = solve( camera_in );
+        store = NULL;
+        return good;
+    }
+    
+    bool RobustLeastSq::solve( Camera *camera_in )
     {
         float eps = 1e-3;
         int iter = 0;
         bool good_once = false;
+        lastNumInliers = 0;
         for ( int i = 0; i < niter; i++ ) {
             bool good = updatePose( camera_in, iter++, eps );
             if ( !good ) eps *= 10.;
             else good_once = true;
         }
+        
+        ninliers = lastNumInliers;
+        rms = ( ninliers > 0 ) ? sqrt( lastInlierErr / ninliers ) : 0;
+        covariance.setZero();
+        if ( ninliers >= 3 )
+        {
+            // scale the inverse information matrix by the weighted residual variance (two residuals per point, six parameters)
+            double dof = 2. * lastWeightSum - 6.;
+            double sigmasq = ( dof > 0 ) ? lastWeightedErr / dof : 1.;
+            Eigen::Matrix<double,6,6> FtF = lastFtF.cast<double>();
+            covariance = sigmasq * FtF.ldlt().solve( Eigen::Matrix<double,6,6>::Identity() );
+        }
+        
         return good_once;
     }
     
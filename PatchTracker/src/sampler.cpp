@@ -10,8 +10,15 @@
 
 #include <PatchTracker/sampler.h>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <cstdio>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <Eigen/Core>
 
 #include <opencv2/imgproc/imgproc.hpp>
@@ -26,9 +33,9 @@ namespace vrlt {
         return true;
     }
     
-    bool Sampler::samplePatch( cv::Mat &sourceImage, const Eigen::Vector2f &center, const Eigen::Matrix3f &warp, float scale, cv::Mat &templatePatch )
+    Eigen::Matrix3f Sampler::warpMatrix( const Eigen::Vector2f &center, const Eigen::Matrix3f &warp, float scale, int size )
     {
-        float offset = ( templatePatch.size().width - 1. ) / 2.;
+        float offset = ( size - 1. ) / 2.;
         
         Eigen::Matrix3f M;
         M <<
@@ -44,7 +51,18 @@ namespace vrlt {
         0, scale, 0.5f*scale-0.5f,
         0, 0, 1;
         
-        M = scale_mat * M;
+        return scale_mat * M;
+    }
+    
+    bool Sampler::samplePatch( cv::Mat &sourceImage, const Eigen::Vector2f &center, const Eigen::Matrix3f &warp, float scale, cv::Mat &templatePatch )
+    {
+        Eigen::Matrix3f M = warpMatrix( center, warp, scale, templatePatch.size().width );
+        
+        if ( templatePatch.size() == cv::Size(8,8) && templatePatch.type() == CV_8UC1 && templatePatch.isContinuous() )
+        {
+            warpPatch( sourceImage, M, templatePatch.ptr() );
+            return true;
+        }
         
         cv::Mat cvM( 3, 3, CV_32FC1 );
         cv::eigen2cv( M, cvM );
@@ -52,5 +70,126 @@ namespace vrlt {
         
         return true;
     }
+    
+    // cv::warpPerspective quantizes source coordinates to 1/32 pixel and interpolates with 15-bit fixed-point weights
+    static const int kInterBits = 5;
+    static const int kInterTabSize = 1 << kInterBits;
+    static const int kCoefBits = 15;
+    
+    static inline short saturateShort( int v )
+    {
+        return (short)std::min( std::max( v, -32768 ), 32767 );
+    }
+    
+    // source coordinates of eight patch pixels, in 1/32 pixel
+    static inline void warpRow( const double *M, int y, int *X, int *Y )
+    {
+        double X0 = M[1]*y + M[2];
+        double Y0 = M[4]*y + M[5];
+        double W0 = M[7]*y + M[8];
+        
+#ifdef __SSE2__
+        const __m128d its = _mm_set1_pd( kInterTabSize );
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d intmin = _mm_set1_pd( (double)INT_MIN );
+        const __m128d intmax = _mm_set1_pd( (double)INT_MAX );
+        for ( int x = 0; x < 8; x += 2 )
+        {
+            __m128d vx = _mm_set_pd( x+1, x );
+            __m128d W = _mm_add_pd( _mm_set1_pd( W0 ), _mm_mul_pd( _mm_set1_pd( M[6] ), vx ) );
+            W = _mm_andnot_pd( _mm_cmpeq_pd( W, zero ), _mm_div_pd( its, W ) );
+            __m128d fX = _mm_mul_pd( _mm_add_pd( _mm_set1_pd( X0 ), _mm_mul_pd( _mm_set1_pd( M[0] ), vx ) ), W );
+            __m128d fY = _mm_mul_pd( _mm_add_pd( _mm_set1_pd( Y0 ), _mm_mul_pd( _mm_set1_pd( M[3] ), vx ) ), W );
+            fX = _mm_max_pd( intmin, _mm_min_pd( intmax, fX ) );
+            fY = _mm_max_pd( intmin, _mm_min_pd( intmax, fY ) );
+            _mm_storel_epi64( (__m128i*)( X + x ), _mm_cvtpd_epi32( fX ) );
+            _mm_storel_epi64( (__m128i*)( Y + x ), _mm_cvtpd_epi32( fY ) );
+        }
+#else
+        for ( int x = 0; x < 8; x++ )
+        {
+            double W = W0 + M[6]*x;
+            W = ( W != 0 ) ? kInterTabSize / W : 0;
+            double fX = std::max( (double)INT_MIN, std::min( (double)INT_MAX, ( X0 + M[0]*x ) * W ) );
+            double fY = std::max( (double)INT_MIN, std::min( (double)INT_MAX, ( Y0 + M[3]*x ) * W ) );
+            X[x] = (int)lrint( fX );
+            Y[x] = (int)lrint( fY );
+        }
+#endif
+    }
+    
+    static inline unsigned char samplePixel( const cv::Mat &image, int X, int Y )
+    {
+        int sx = saturateShort( X >> kInterBits );
+        int sy = saturateShort( Y >> kInterBits );
+        int ax = X & ( kInterTabSize - 1 );
+        int ay = Y & ( kInterTabSize - 1 );
+        
+        // bilinear weights, which sum to 1 << kCoefBits
+        int w00 = ( kInterTabSize - ax ) * ( kInterTabSize - ay ) * 32;
+        int w01 = ax * ( kInterTabSize - ay ) * 32;
+        int w10 = ( kInterTabSize - ax ) * ay * 32;
+        int w11 = ax * ay * 32;
+        
+        const int width = image.cols;
+        const int height = image.rows;
+        
+        int v00, v01, v10, v11;
+        if ( (unsigned)sx < (unsigned)( width - 1 ) && (unsigned)sy < (unsigned)( height - 1 ) )
+        {
+            const unsigned char *S0 = image.ptr( sy ) + sx;
+            const unsigned char *S1 = image.ptr( sy + 1 ) + sx;
+            v00 = S0[0];
+            v01 = S0[1];
+            v10 = S1[0];
+            v11 = S1[1];
+        }
+        else
+        {
+            // pixels outside the image are zero
+            if ( sx >= width || sx + 1 < 0 || sy >= height || sy + 1 < 0 ) return 0;
+            
+            bool x0in = ( sx >= 0 );
+            bool x1in = ( sx + 1 < width );
+            bool y0in = ( sy >= 0 );
+            bool y1in = ( sy + 1 < height );
+            v00 = ( x0in && y0in ) ? image.ptr( sy )[sx] : 0;
+            v01 = ( x1in && y0in ) ? image.ptr( sy )[sx+1] : 0;
+            v10 = ( x0in && y1in ) ? image.ptr( sy + 1 )[sx] : 0;
+            v11 = ( x1in && y1in ) ? image.ptr( sy + 1 )[sx+1] : 0;
+        }
+        
+        int sum = v00 * w00 + v01 * w01 + v10 * w10 + v11 * w11;
+        return (unsigned char)( ( sum + ( 1 << ( kCoefBits - 1 ) ) ) >> kCoefBits );
+    }
+    
+    void warpPatch( const cv::Mat &image, const Eigen::Matrix3f &M, unsigned char *patch )
+    {
+        if ( image.type() != CV_8UC1 )
+        {
+            cv::Mat cvM( 3, 3, CV_32FC1 );
+            cv::eigen2cv( M, cvM );
+            cv::Mat templatePatch( cv::Size(8,8), CV_8UC1, patch );
+            cv::warpPerspective( image, templatePatch, cvM, templatePatch.size(), cv::WARP_INVERSE_MAP );
+            return;
+        }
+        
+        // row-major, in double precision like cv::warpPerspective
+        double Md[9];
+        for ( int r = 0; r < 3; r++ )
+            for ( int c = 0; c < 3; c++ )
+                Md[3*r+c] = M(r,c);
+        
+        int X[8], Y[8];
+        for ( int y = 0; y < 8; y++ )
+        {
+            warpRow( Md, y, X, Y );
+            for ( int x = 0; x < 8; x++ ) patch[8*y+x] = samplePixel( image, X[x], Y[x] );
+        }
+    }
+    
+    void warpPatches( const PatchWarp *warps, int count )
+    {
+        for ( int i = 0; i < count; i++ ) warpPatch( *warps[i].image, warps[i].M, warps[i].patch );
+    }
 }
-
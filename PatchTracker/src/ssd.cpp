@@ -227,7 +227,7 @@ namespace vrlt {
         float *ptr1 = (float*)im1.ptr();
         float *ptr2 = (float*)im2.ptr();
         float corr = 0;
-        int N = im1.size().width * im1.size().width;
+        int N = im1.size().width * im1.size().height;
         for ( int n = 0; n < N; n++ ) corr += ptr1[n] * ptr2[n];
         return corr;
 #endif
@@ -11,22 +11,20 @@
 #include <PatchTracker/tracker.h>
 #include <PatchTracker/patch.h>
 #include <PatchTracker/nccsearch.h>
+#include <MultiView/parallel.h>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include <Eigen/Eigen>
 
+#include <algorithm>
 #include <iostream>
 
 #ifdef USE_ACCELERATE
 #include <Accelerate/Accelerate.h>
 #endif
 
-#ifdef USE_DISPATCH
-#include <dispatch/dispatch.h>
-#endif
-
 #ifdef __APPLE__
 #include "TargetConditionals.h"
 #endif
@@ -43,6 +41,11 @@ namespace vrlt
         bool operator()( const Patch *a, const Patch *b ) { return ( a->shouldTrack > b->shouldTrack ); }
     };
     
+    struct SortRanks
+    {
+        bool operator()( const std::pair<int,Patch*> &a, const std::pair<int,Patch*> &b ) { return ( a.first < b.first ); }
+    };
+    
     void Tracker::precomputeGlobalPoses( Node *node )
     {
         if ( node->camera != NULL ) cameras.push_back( node->camera );
@@ -59,9 +62,10 @@ namespace vrlt
     Tracker::Tracker( Node *_root, int _maxnumpoints, std::string method, double threshold )
     : ntracked( 0 ), root( _root ), nattempted( 0 ), verbose( false ),
     maxnumpoints( _maxnumpoints ), firstlevel( 3 ), lastlevel( 1 ), niter( 10 ),
-    recompute_sigmasq(true)
+    recompute_sigmasq(true), reuse_visible( false ), atlas( NULL ), images( NULL ), nprefetch( 8 )
     {
         do_pose_update = true;
+        gridstep = cv::Size( 40, 40 );
         
         precomputeGlobalPoses( root );
         
@@ -79,6 +83,17 @@ namespace vrlt
             patches[i] = new Patch( point );
         }
         random_shuffle( patches.begin(), patches.end() );
+        
+        std::vector<Point*> points( patches.size() );
+        std::vector<Eigen::Vector4d> positions( patches.size() );
+        for ( size_t j = 0; j < patches.size(); j++ )
+        {
+            patches[j]->storeIndex = j;
+            points[j] = patches[j]->point;
+            positions[j] = points[j]->position;
+        }
+        pointStore.build( points );
+        pointGrid.build( positions );
         patchSearcher = NULL;
 		patchSearcher = new PatchSearchNCC( maxnumpoints );
 		patchSearcher->lowThreshold = threshold;
@@ -133,6 +148,7 @@ namespace vrlt
     void checkPoint( void *context, size_t i )
     {
         Tracker *tracker = (Tracker *)context;
+        const PointStore &store = tracker->pointStore;
         
         Point *point = tracker->patches[i]->point;
         point->tracked = false;
@@ -147,7 +163,7 @@ namespace vrlt
 
         // NB: Eigen is column major
         // check in front of camera
-        pointData = point->position.cast<float>();
+        pointData << store.x[i], store.y[i], store.z[i], store.w[i];
 #ifdef USE_ACCELERATE
         vDSP_dotpr( tracker->poseMatrix.data() + 3, 4, pointData.data(), 1, PX.data()+2, 4 );
 #else
@@ -173,7 +189,7 @@ namespace vrlt
             return;
         }
                 
-        normalData = point->normal.cast<float>();
+        normalData << store.nx[i], store.ny[i], store.nz[i];
 #ifdef USE_ACCELERATE
         vDSP_dotpr( tracker->poseMatrix.data()    , 4, normalData.data(), 1, PN.data()  , 3 );
         vDSP_dotpr( tracker->poseMatrix.data() + 1, 4, normalData.data(), 1, PN.data()+1, 3 );
@@ -190,7 +206,7 @@ namespace vrlt
         D = -(PN.dot(PX));
 #endif
         
-        // choose source image
+        // the source image is chosen by selectSource()
         Patch *sourcepatch = tracker->patches[i];
         sourcepatch->shouldTrack = true;
         sourcepatch->bestLevel = 4;
@@ -200,13 +216,29 @@ namespace vrlt
         sourcepatch->center = proj;
         sourcepatch->warpcenter = sourcepatch->center;
         sourcepatch->source = NULL;
+        
+        tracker->visiblePatches[i] = sourcepatch;
+    }
+    
+    void checkCandidate( void *context, size_t i )
+    {
+        Tracker *tracker = (Tracker *)context;
+        checkPoint( context, tracker->candidateIndices[i] );
+    }
+    
+    void selectSource( void *context, size_t i )
+    {
+        Tracker *tracker = (Tracker *)context;
+        
+        size_t index = tracker->candidateIndices[i];
+        Patch *sourcepatch = tracker->visiblePatches[index];
+        
+        // choose source image
         sourcepatch->updateTarget( tracker->current_camera );
         sourcepatch->chooseSource( tracker->use_new_cameras );
         if ( sourcepatch->source == NULL ) {
-            return;
+            tracker->visiblePatches[index] = NULL;
         }
-        
-        tracker->visiblePatches[i] = sourcepatch;
     }
     
     void preparePatch( void *context, size_t i )
@@ -245,59 +277,172 @@ namespace vrlt
         v = c->calibration->center[1];
     }
     
+    void Tracker::spreadPatches( int count )
+    {
+        cv::Size size = current_camera->image.size();
+        int cols = ( size.width + gridstep.width - 1 ) / gridstep.width;
+        int rows = ( size.height + gridstep.height - 1 ) / gridstep.height;
+        grid = cv::Mat::zeros( rows, cols, CV_32SC1 );
+        
+        // rank each patch by how many came before it in its cell, so that any number of patches taken from the
+        // front covers the cells evenly; the patches are shuffled, so those kept in a cell are a random sample
+        std::vector< std::pair<int,Patch*> > ranked( count );
+        for ( int i = 0; i < count; i++ )
+        {
+            Patch *patch = searchPatches[i];
+            int x = std::min( std::max( (int)patch->center[0] / gridstep.width, 0 ), cols-1 );
+            int y = std::min( std::max( (int)patch->center[1] / gridstep.height, 0 ), rows-1 );
+            ranked[i] = std::make_pair( grid.at<int>( y, x )++, patch );
+        }
+        std::stable_sort( ranked.begin(), ranked.end(), SortRanks() );
+        
+        for ( int i = 0; i < count; i++ ) searchPatches[i] = ranked[i].second;
+    }
+    
+    struct SortDistances
+    {
+        bool operator()( const std::pair<double,Camera*> &a, const std::pair<double,Camera*> &b ) { return ( a.first < b.first ); }
+    };
+    
+    // how much of a camera's recent use as a source carries over to the next frame
+    static const double kSourceUseDecay = 0.8;
+    // how strongly recent use pulls a camera ahead of closer ones when prefetching
+    static const double kSourceUseWeight = 4.;
+    
+    void Tracker::provideImages( int count )
+    {
+        std::vector<Camera*> sources;
+        for ( int i = 0; i < count; i++ ) sources.push_back( searchPatches[i]->source );
+        
+        // the cameras chooseSource() keeps picking are the likeliest sources of the next frames
+        std::map<Camera*,double>::iterator it;
+        for ( it = sourceUse.begin(); it != sourceUse.end(); )
+        {
+            it->second *= kSourceUseDecay;
+            if ( it->second < 1e-3 ) sourceUse.erase( it++ );
+            else it++;
+        }
+        for ( int i = 0; i < count; i++ ) sourceUse[ sources[i] ] += 1. / count;
+        
+        std::sort( sources.begin(), sources.end() );
+        sources.erase( std::unique( sources.begin(), sources.end() ), sources.end() );
+        images->require( sources );
+        
+        // otherwise they are the cameras closest to this one which look the same way
+        std::vector< std::pair<double,Camera*> > nearby;
+        Sophus::SE3d poseinv = mynode->pose.inverse();
+        for ( size_t i = 0; i < cameras.size(); i++ )
+        {
+            // only cameras still in the list are looked up, as the map may hold cameras since removed
+            it = sourceUse.find( cameras[i] );
+            double use = ( it != sourceUse.end() ) ? it->second : 0.;
+            
+            Sophus::SE3d rel_pose = cameras[i]->node->precomputedGlobalPose * poseinv;
+            if ( use == 0 && rel_pose.so3().log().norm() > M_PI / 3 ) continue;
+            nearby.push_back( std::make_pair( rel_pose.translation().norm() / ( 1. + kSourceUseWeight * use ), cameras[i] ) );
+        }
+        size_t nkeep = std::min( nearby.size(), (size_t)nprefetch );
+        std::partial_sort( nearby.begin(), nearby.begin() + nkeep, nearby.end(), SortDistances() );
+        
+        std::vector<Camera*> predicted;
+        for ( size_t i = 0; i < nkeep; i++ ) predicted.push_back( nearby[i].second );
+        images->prefetch( predicted );
+    }
+    
     bool Tracker::track( Camera *camera_in, bool _use_new_cameras )
     {
+        uint64_t frameStart = Timer::getTime();
+        
         use_new_cameras = _use_new_cameras;
         
         mynode->pose = camera_in->node->pose;
         
-#ifdef USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-#endif
-        
         camera_in->calibration->makeKinverse();
         setCurrentCamera( camera_in );
         
-        for ( size_t i = 0; i < visiblePatches.size(); i++ ) visiblePatches[i] = NULL;
+        profiler.beginFrame();
         
-        // find all points which are potentially visible in the image
-#ifdef USE_DISPATCH
-        dispatch_apply_f( patches.size(), queue, this, checkPoint );
-#else
-        for ( size_t i = 0; i < patches.size(); i++ ) {
+        // only points found visible by the last call can still be marked
+        pointStore.clearTracked();
+        for ( size_t j = 0; j < visibleIndices.size(); j++ )
+        {
+            visiblePatches[visibleIndices[j]] = NULL;
+            patches[visibleIndices[j]]->point->tracked = false;
+        }
+        
+        {
+            Profiler::Scope scope( profiler, "cull" );
             cullTimer.start();
-            checkPoint( this, i );
+            
+            // the pose has barely moved since the last call, so only its visible points need checking again;
+            // otherwise check the points in grid cells which intersect the view
+            if ( reuse_visible ) candidateIndices = visibleIndices;
+            else pointGrid.cull( poseMatrix, f, u, v, current_camera->image.size(), candidateIndices );
+            
+            // find all points which project into the image
+            parallel_for( candidateIndices.size(), this, checkCandidate );
+            
+            size_t ninimage = 0;
+            for ( size_t j = 0; j < candidateIndices.size(); j++ )
+            {
+                if ( visiblePatches[candidateIndices[j]] != NULL ) candidateIndices[ninimage++] = candidateIndices[j];
+            }
+            candidateIndices.resize( ninimage );
+            
             cullTimer.stop();
+            scope.count = (int)ninimage;
+        }
+        
+        {
+            Profiler::Scope scope( profiler, "source selection", -1, (int)candidateIndices.size() );
+            parallel_for( candidateIndices.size(), this, selectSource );
         }
-#endif
         
+        // candidates are in increasing order, so the points kept below match a check of the whole map
         int count = 0;
-        for ( int i = 0; i < visiblePatches.size(); i++ )
+        std::vector<size_t> newVisible;
+        for ( size_t j = 0; j < candidateIndices.size(); j++ )
         {
-            if ( visiblePatches[i] != NULL ) {
-                searchPatches[count++] = visiblePatches[i];
-            }
+            Patch *patch = visiblePatches[candidateIndices[j]];
+            if ( patch == NULL ) continue;
+            searchPatches[count++] = patch;
+            newVisible.push_back( candidateIndices[j] );
         }
+        if ( !reuse_visible ) visibleIndices.swap( newVisible );
         
         prev_pose = Sophus::SE3d();
         
         std::vector<Point*> new_points;
         std::vector<Patch*> new_patches;
         
-        // reduce number of patches
-        if ( count > maxnumpoints )
+        // choose the number of patches and the first level which fit the frame-time budget
+        int npatches, startlevel;
+        budget.plan( maxnumpoints, firstlevel, lastlevel, npatches, startlevel );
+        budget.recordFixed( ( Timer::getTime() - frameStart ) * 1e-9 );
+        
+        // reduce number of patches, keeping them spread over the image
+        if ( count > npatches )
         {
-            count = maxnumpoints;
+            spreadPatches( count );
+            count = npatches;
         }
         
         nattempted = count;
+        
+        if ( images != NULL && atlas == NULL )
+        {
+            Profiler::Scope scope( profiler, "image loading" );
+            provideImages( count );
+        }
 
         int firstcount = count;
         if ( verbose ) std::cout << "first count: " << count << "\n";
         
         // iterate through pyramid
-        for ( int level = firstlevel; level >= lastlevel; level-- )
+        for ( int level = startlevel; level >= lastlevel; level-- )
         {
+            uint64_t levelStart = Timer::getTime();
+            int levelcount = count;
             float levelScale = powf( 2.f, -level );
             patchSearcher->level = level;
 
@@ -309,40 +454,42 @@ namespace vrlt
             mycamera->image = camera_in->pyramid.levels[level].image;
 
             setCurrentCamera( mycamera );
-            if ( level == firstlevel ) {
-#ifdef USE_DISPATCH
-                dispatch_apply_f( count, queue, this, preparePatch );
-#else
-                for ( int i = 0; i < count; i++ ) preparePatch( this, i );
-#endif
-            } else {
-#ifdef USE_DISPATCH
-                dispatch_apply_f( count, queue, this, levelupPatch );
-#else
-                for ( int i = 0; i < count; i++ ) levelupPatch( this, i );
-#endif
-            }
             
             int newcount;
-            patchSearcher->begin = searchPatches.begin();
-            newcount = patchSearcher->makeTemplates( count );
-            std::sort( searchPatches.begin(), searchPatches.begin()+count, SortPatches() );
-            count = newcount;
+            {
+                Profiler::Scope scope( profiler, "template warping", level, count );
+                
+                // these are cheap per patch, so each task takes a good number of them
+                if ( level == startlevel ) parallel_for( count, this, preparePatch, 64 );
+                else parallel_for( count, this, levelupPatch, 64 );
+                
+                patchSearcher->begin = searchPatches.begin();
+                patchSearcher->atlas = atlas;
+                newcount = patchSearcher->makeTemplates( count );
+                std::sort( searchPatches.begin(), searchPatches.begin()+count, SortPatches() );
+                count = newcount;
+            }
             if ( verbose ) std::cout << "after templates: count at level " << level << ": " << count << "\n";
 
-            patchSearcher->begin = searchPatches.begin();
-            newcount = patchSearcher->doSearch( count );
-            std::sort( searchPatches.begin(), searchPatches.begin()+count, SortPatches() );
-            count = newcount;
+            {
+                Profiler::Scope scope( profiler, "search", level, count );
+                patchSearcher->begin = searchPatches.begin();
+                newcount = patchSearcher->doSearch( count );
+                std::sort( searchPatches.begin(), searchPatches.begin()+count, SortPatches() );
+                count = newcount;
+            }
             if ( verbose ) std::cout << "after search: count at level " << level << ": " << count << "\n";
             
-            if ( level == firstlevel )
+            budget.recordLevel( levelcount, ( Timer::getTime() - levelStart ) * 1e-9 );
+            
+            if ( level == startlevel )
             {
                 ntracked = 0;
                 nnew = 0;
                 ntracked = count;
                 for ( int i = 0; i < count; i++ ) {
                     searchPatches[i]->point->tracked = true;
+                    pointStore.setTracked( searchPatches[i]->storeIndex );
                     if ( searchPatches[i]->source->isnew ) nnew++;
                 }
                 
@@ -364,6 +511,7 @@ namespace vrlt
             sourcepatch->targetPos[0] = ( sourcepatch->targetPos[0] + .5f ) * scale - .5f;
             sourcepatch->targetPos[1] = ( sourcepatch->targetPos[1] + .5f ) * scale - .5f;
             sourcepatch->point->location = sourcepatch->targetPos;
+            pointStore.setLocation( sourcepatch->storeIndex, sourcepatch->targetPos );
             
             if ( sourcepatch->point->position[3] == 0 ) {
                 Eigen::Vector3d X = sourcepatch->point->position.head(3);
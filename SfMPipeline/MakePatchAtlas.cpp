@@ -0,0 +1,71 @@
+#include <MultiView/multiview.h>
+#include <MultiView/multiview_io_xml.h>
+#include <PatchTracker/patchatlas.h>
+
+#include <opencv2/highgui.hpp>
+
+#include <iostream>
+#include <sstream>
+
+using namespace vrlt;
+
+void loadImages( const std::string &prefix, Node *node )
+{
+    if ( node->camera != NULL ) {
+        std::stringstream path;
+        path << prefix << "/" << node->camera->path;
+        node->camera->image = cv::imread( path.str(), cv::IMREAD_GRAYSCALE );
+        node->camera->pyramid = ImagePyramid( node->camera );
+    }
+    
+    ElementList::iterator it;
+    for ( it = node->children.begin(); it != node->children.end(); it++ )
+    {
+        Node *child = (Node *)it->second;
+        loadImages( prefix, child );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc != 2 && argc != 3 ) {
+        fprintf( stderr, "usage: %s <reconstruction> [<patch size>]\n", argv[0] );
+        fprintf( stderr, "writes <reconstruction>/atlas.dat, which the tracker can use in place of the images\n" );
+        exit(1);
+    }
+    
+    std::string pathin = std::string(argv[1]);
+    int size = ( argc == 3 ) ? atoi( argv[2] ) : 16;
+    if ( size < 10 ) {
+        fprintf( stderr, "error: patches must be at least 10 pixels wide to hold a template\n" );
+        exit(1);
+    }
+    
+    Reconstruction r;
+    r.pathPrefix = pathin;
+    std::stringstream mypath;
+    mypath << pathin << "/reconstruction.xml";
+    XML::read( r, mypath.str() );
+    Node *root = (Node*)r.nodes["root"];
+    if ( root == NULL ) {
+        std::cerr << "error: could not read reconstruction at " << pathin << "\n";
+        exit(1);
+    }
+    
+    loadImages( pathin, root );
+    
+    PatchAtlas atlas;
+    atlas.make( root, size );
+    
+    std::stringstream atlaspath;
+    atlaspath << pathin << "/atlas.dat";
+    if ( !atlas.write( atlaspath.str() ) ) {
+        std::cerr << "error: could not write " << atlaspath.str() << "\n";
+        exit(1);
+    }
+    
+    double megabytes = atlas.count() * NLEVELS * size * size / 1048576.;
+    std::cout << "wrote " << atlas.count() << " patches (" << megabytes << " MB) to " << atlaspath.str() << "\n";
+    
+    return 0;
+}
@@ -3,10 +3,7 @@
 #define THREADED_H
 
 #include <MultiView/multiview.h>
-
-#if USE_DISPATCH
-#include <dispatch/dispatch.h>
-#endif
+#include <MultiView/parallel.h>
 
 namespace vrlt
 {
@@ -38,15 +35,8 @@ namespace vrlt
         ThreadInfo ti;
         ti.threads = threads;
         
-#if USE_DISPATCH
-        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
-        dispatch_apply_f( threads.size(), queue, &ti, runThread );
-#else
-        for ( int i = 0; i < threads.size(); i++ )
-        {
-            runThread( &ti, i );
-        }
-#endif
+        // each job is large, so they are handed out one at a time
+        parallel_for( threads.size(), &ti, runThread, 1 );
         
         for ( int i = 0; i < threads.size(); i++ )
         {
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: LocalizerLoadTest.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <MultiView/multiview.h>
+#include <MultiView/multiview_io_xml.h>
+#include <LocalizerClient/client.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <dirent.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+
+using namespace vrlt;
+
+typedef std::chrono::steady_clock Clock;
+
+struct Frame
+{
+    std::string path;
+    std::vector<unsigned char> bytes;
+};
+
+struct Sample
+{
+    int client;
+    int frame;
+    double sendTime;        // seconds since start of test
+    double latency;         // send to reply
+    double scheduledLatency;// scheduled send time to reply (includes time spent waiting on earlier requests)
+    double serverTime;      // time the server reports spending on the request
+    int ninliers;
+    bool received;
+    bool localized;
+};
+
+struct LoadTest
+{
+    std::vector<Frame> frames;
+    std::string servIP;
+    int portno;
+    int nclients;
+    int nframes;
+    double rate;
+
+    Clock::time_point start;
+
+    std::mutex mutex;
+    std::vector<Sample> samples;
+    int nconnectfailures;
+    int nunsent;            // frames left unsent by clients whose connection failed
+};
+
+static double secondsSince( const Clock::time_point &t0, const Clock::time_point &t1 )
+{
+    return std::chrono::duration<double>( t1 - t0 ).count();
+}
+
+static bool readFile( const std::string &path, std::vector<unsigned char> &bytes )
+{
+    FILE *f = fopen( path.c_str(), "rb" );
+    if ( f == NULL ) return false;
+
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+
+    bytes.resize( size );
+    size_t nread = fread( &bytes[0], 1, size, f );
+    fclose( f );
+
+    return ( nread == (size_t)size && size > 0 );
+}
+
+static bool hasImageExtension( const std::string &name )
+{
+    size_t dot = name.rfind( '.' );
+    if ( dot == std::string::npos ) return false;
+    std::string ext = name.substr( dot+1 );
+    std::transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+    return ( ext == "jpg" || ext == "jpeg" || ext == "png" );
+}
+
+static void listFrames( const std::string &input, std::vector<std::string> &paths )
+{
+    size_t dot = input.rfind( '.' );
+    if ( dot != std::string::npos && input.substr( dot ) == ".xml" )
+    {
+        // query reconstruction, as given to TestLocalizer
+        Reconstruction query;
+        XML::read( query, input );
+
+        ElementList::iterator it;
+        for ( it = query.cameras.begin(); it != query.cameras.end(); it++ )
+        {
+            Camera *camera = (Camera *)it->second;
+            paths.push_back( camera->path );
+        }
+        return;
+    }
+
+    DIR *dir = opendir( input.c_str() );
+    if ( dir == NULL ) return;
+
+    struct dirent *entry;
+    while ( ( entry = readdir( dir ) ) != NULL )
+    {
+        std::string name( entry->d_name );
+        if ( !hasImageExtension( name ) ) continue;
+        paths.push_back( input + "/" + name );
+    }
+    closedir( dir );
+
+    std::sort( paths.begin(), paths.end() );
+}
+
+static void runClient( LoadTest *test, int client )
+{
+    LocalizationClient localizationClient( 1, 0, LOCALIZER_PROTOCOL_VERSION );
+    if ( !localizationClient.connectToServer( test->servIP, test->portno ) )
+    {
+        std::lock_guard<std::mutex> lock( test->mutex );
+        test->nconnectfailures++;
+        return;
+    }
+
+    // each client sends at rate/nclients so that the aggregate offered load is rate
+    double interval = ( test->rate > 0 ) ? test->nclients / test->rate : 0;
+
+    // stagger clients so they don't all send on the same tick
+    double offset = ( test->nclients > 0 ) ? interval * client / test->nclients : 0;
+
+    std::vector<Sample> mysamples;
+    mysamples.reserve( test->nframes );
+
+    for ( int i = 0; i < test->nframes; i++ )
+    {
+        int index = ( client + i * test->nclients ) % (int)test->frames.size();
+        Frame &frame = test->frames[index];
+
+        Clock::time_point scheduled = test->start + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( offset + i * interval ) );
+        if ( Clock::now() < scheduled ) std::this_thread::sleep_until( scheduled );
+
+        Sample sample;
+        sample.client = client;
+        sample.frame = index;
+        sample.received = false;
+        sample.localized = false;
+        sample.serverTime = 0;
+        sample.ninliers = 0;
+
+        Clock::time_point sent = Clock::now();
+        sample.sendTime = secondsSince( test->start, sent );
+
+        LocalizationReply reply;
+        bool good = localizationClient.sendImage( (int)frame.bytes.size(), &frame.bytes[0] );
+        if ( good ) good = localizationClient.recvReply( &reply );
+
+        Clock::time_point received = Clock::now();
+        sample.latency = secondsSince( sent, received );
+        sample.scheduledLatency = secondsSince( ( test->rate > 0 ) ? scheduled : sent, received );
+        sample.received = good;
+
+        if ( good )
+        {
+            sample.localized = ( reply.status != ReplyFailed );
+            sample.serverTime = reply.totalTime;
+            sample.ninliers = reply.ninliers;
+        }
+
+        mysamples.push_back( sample );
+
+        if ( !good )
+        {
+            // the connection is gone, so the rest of this client's frames fail too
+            std::lock_guard<std::mutex> lock( test->mutex );
+            test->nunsent += test->nframes - i - 1;
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock( test->mutex );
+    test->samples.insert( test->samples.end(), mysamples.begin(), mysamples.end() );
+}
+
+static double percentile( const std::vector<double> &sorted, double p )
+{
+    if ( sorted.empty() ) return 0;
+    size_t index = (size_t)ceil( p * sorted.size() );
+    if ( index > 0 ) index--;
+    if ( index >= sorted.size() ) index = sorted.size()-1;
+    return sorted[index];
+}
+
+static void printLatencies( FILE *f, const char *label, std::vector<double> latencies )
+{
+    std::sort( latencies.begin(), latencies.end() );
+
+    double sum = 0;
+    for ( size_t i = 0; i < latencies.size(); i++ ) sum += latencies[i];
+    double mean = ( latencies.empty() ) ? 0 : sum / latencies.size();
+
+    fprintf( f, "%s latency (ms):\n", label );
+    fprintf( f, "    min:  %.2lf\n", ( latencies.empty() ) ? 0 : latencies.front()*1000 );
+    fprintf( f, "    mean: %.2lf\n", mean*1000 );
+    fprintf( f, "    p50:  %.2lf\n", percentile( latencies, 0.50 )*1000 );
+    fprintf( f, "    p90:  %.2lf\n", percentile( latencies, 0.90 )*1000 );
+    fprintf( f, "    p95:  %.2lf\n", percentile( latencies, 0.95 )*1000 );
+    fprintf( f, "    p99:  %.2lf\n", percentile( latencies, 0.99 )*1000 );
+    fprintf( f, "    max:  %.2lf\n", ( latencies.empty() ) ? 0 : latencies.back()*1000 );
+}
+
+static void writeReport( FILE *f, LoadTest &test, double elapsed )
+{
+    std::vector<double> latencies;
+    std::vector<double> scheduledLatencies;
+    std::vector<double> serverTimes;
+    int nlocalized = 0;
+    int nfailed = 0;
+
+    for ( size_t i = 0; i < test.samples.size(); i++ )
+    {
+        Sample &sample = test.samples[i];
+        if ( !sample.received ) {
+            nfailed++;
+            continue;
+        }
+        latencies.push_back( sample.latency );
+        scheduledLatencies.push_back( sample.scheduledLatency );
+        serverTimes.push_back( sample.serverTime );
+        if ( sample.localized ) nlocalized++;
+    }
+
+    int ncompleted = (int)latencies.size();
+    nfailed += test.nunsent;
+
+    fprintf( f, "server:              %s:%d\n", test.servIP.c_str(), test.portno );
+    fprintf( f, "clients:             %d\n", test.nclients );
+    fprintf( f, "frames per client:   %d\n", test.nframes );
+    if ( test.rate > 0 ) fprintf( f, "target rate:         %.2lf frames/s\n", test.rate );
+    else fprintf( f, "target rate:         closed loop (no pacing)\n" );
+    fprintf( f, "connect failures:    %d\n", test.nconnectfailures );
+    fprintf( f, "requests completed:  %d\n", ncompleted );
+    fprintf( f, "requests failed:     %d (%d never sent)\n", nfailed, test.nunsent );
+    fprintf( f, "localized:           %d (%.1lf%%)\n", nlocalized, ( ncompleted > 0 ) ? 100.*nlocalized/ncompleted : 0. );
+    fprintf( f, "elapsed:             %.2lf s\n", elapsed );
+    fprintf( f, "throughput:          %.2lf frames/s\n", ( elapsed > 0 ) ? ncompleted / elapsed : 0. );
+    printLatencies( f, "end-to-end", latencies );
+    if ( test.rate > 0 ) printLatencies( f, "scheduled", scheduledLatencies );
+    printLatencies( f, "server-side", serverTimes );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 5 || argc > 7 ) {
+        fprintf( stderr, "usage: %s <query xml | image directory> <num clients> <rate> <frames per client> [<server ip>] [<port>]\n", argv[0] );
+        fprintf( stderr, "       rate is the aggregate target in frames/s; use 0 to send as fast as replies arrive\n" );
+        exit(1);
+    }
+
+    LoadTest test;
+    test.nclients = atoi(argv[2]);
+    test.rate = atof(argv[3]);
+    test.nframes = atoi(argv[4]);
+    test.servIP = ( argc > 5 ) ? std::string(argv[5]) : std::string("127.0.0.1");
+    test.portno = ( argc > 6 ) ? atoi(argv[6]) : 12345;
+    test.nconnectfailures = 0;
+    test.nunsent = 0;
+
+    if ( test.nclients < 1 || test.nframes < 1 )
+    {
+        fprintf( stderr, "error: need at least one client and one frame per client\n" );
+        exit(1);
+    }
+
+    std::vector<std::string> paths;
+    listFrames( std::string(argv[1]), paths );
+
+    for ( size_t i = 0; i < paths.size(); i++ )
+    {
+        Frame frame;
+        frame.path = paths[i];
+        if ( !readFile( frame.path, frame.bytes ) )
+        {
+            std::cerr << "warning: could not read " << frame.path << "\n";
+            continue;
+        }
+        test.frames.push_back( frame );
+    }
+
+    if ( test.frames.empty() )
+    {
+        fprintf( stderr, "error: no frames found in %s\n", argv[1] );
+        exit(1);
+    }
+
+    std::cout << "read " << test.frames.size() << " frames\n";
+
+    test.start = Clock::now();
+
+    std::vector<std::thread> threads;
+    for ( int i = 0; i < test.nclients; i++ )
+    {
+        threads.push_back( std::thread( runClient, &test, i ) );
+    }
+    for ( size_t i = 0; i < threads.size(); i++ )
+    {
+        threads[i].join();
+    }
+
+    double elapsed = secondsSince( test.start, Clock::now() );
+
+    writeReport( stdout, test, elapsed );
+
+    FILE *f = fopen( "loadtest_report.txt", "w" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "error: could not open loadtest_report.txt for writing\n" );
+        exit(1);
+    }
+    writeReport( f, test, elapsed );
+    fclose( f );
+
+    f = fopen( "loadtest_samples.txt", "w" );
+    if ( f == NULL )
+    {
+        fprintf( stderr, "error: could not open loadtest_samples.txt for writing\n" );
+        exit(1);
+    }
+    fprintf( f, "# client frame send_time latency scheduled_latency server_time received localized inliers\n" );
+    for ( size_t i = 0; i < test.samples.size(); i++ )
+    {
+        Sample &sample = test.samples[i];
+        fprintf( f, "%d %d %.6lf %.6lf %.6lf %.6lf %d %d %d\n", sample.client, sample.frame, sample.sendTime, sample.latency, sample.scheduledLatency, sample.serverTime, sample.received ? 1 : 0, sample.localized ? 1 : 0, sample.ninliers );
+    }
+    fclose( f );
+
+    return 0;
+}
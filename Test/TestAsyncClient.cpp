@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: TestAsyncClient.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <LocalizerClient/asyncclient.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+using namespace vrlt;
+
+// drives AsyncLocalizationClient against a fake server on the loopback interface which replies slower than
+// frames are sent and drops the first connection part way through, and checks that every request gets
+// exactly one callback, in request order
+
+static const int kNumFrames = 60;
+static const int kFrameIntervalMs = 5;
+static const int kReplyDelayMs = 20;
+static const int kRepliesBeforeDisconnect = 8;
+
+struct FakeServer
+{
+    int listenfd;
+    int portno;
+    std::atomic<bool> stopping;
+    std::atomic<int> nconnections;
+    std::atomic<int> nreplies;
+    bool badheader;
+    std::thread thread;
+};
+
+struct Result
+{
+    int id;
+    bool success;
+    int frame;
+    double down;
+};
+
+struct Callbacks
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<Result> results;
+};
+
+static bool recvAll( int sock, void *data, size_t nbytes )
+{
+    unsigned char *ptr = (unsigned char *)data;
+    while ( nbytes > 0 )
+    {
+        ssize_t nrecvd = recv( sock, ptr, nbytes, 0 );
+        if ( nrecvd < 0 && errno == EINTR ) continue;
+        if ( nrecvd <= 0 ) return false;
+        ptr += nrecvd;
+        nbytes -= nrecvd;
+    }
+    return true;
+}
+
+static bool sendAll( int sock, const void *data, size_t nbytes )
+{
+    const unsigned char *ptr = (const unsigned char *)data;
+    while ( nbytes > 0 )
+    {
+        ssize_t nsent = send( sock, ptr, nbytes, 0 );
+        if ( nsent < 0 && errno == EINTR ) continue;
+        if ( nsent <= 0 ) return false;
+        ptr += nsent;
+        nbytes -= nsent;
+    }
+    return true;
+}
+
+static void serveConnection( FakeServer *server, int sock )
+{
+    int connection = server->nconnections++;
+
+    int data[2];
+    if ( !recvAll( sock, data, 2*sizeof(int) ) ) return;
+    if ( unpackVersion( data[0] ) != 3 ) server->badheader = true;
+
+    int nreplies = 0;
+    for ( ; ; )
+    {
+        RequestHeader header;
+        if ( !recvAll( sock, &header, requestHeaderSize( 3 ) ) ) break;
+        std::vector<unsigned char> bytes( header.datasize );
+        if ( header.datasize <= 0 || !recvAll( sock, &bytes[0], header.datasize ) ) break;
+
+        std::this_thread::sleep_for( std::chrono::milliseconds( kReplyDelayMs ) );
+
+        // the first connection goes down with requests still in flight
+        if ( connection == 0 && nreplies == kRepliesBeforeDisconnect ) break;
+
+        // echo the frame number and the gravity direction, so the callback can be matched to its frame
+        LocalizationReply reply;
+        memset( &reply, 0, sizeof(reply) );
+        int frame;
+        memcpy( &frame, &bytes[0], sizeof(int) );
+        reply.status = ReplyRefined;
+        reply.ninliers = frame;
+        reply.rms = ( header.flags & RequestHasGravity ) ? header.down[2] : -1;
+        if ( !sendAll( sock, &reply, sizeof(reply) ) ) break;
+        nreplies++;
+        server->nreplies++;
+    }
+}
+
+static void serverLoop( FakeServer *server )
+{
+    while ( !server->stopping )
+    {
+        struct pollfd fds;
+        fds.fd = server->listenfd;
+        fds.events = POLLIN;
+        if ( poll( &fds, 1, 100 ) <= 0 ) continue;
+
+        int sock = accept( server->listenfd, NULL, NULL );
+        if ( sock < 0 ) continue;
+        serveConnection( server, sock );
+        close( sock );
+    }
+}
+
+static bool startServer( FakeServer &server )
+{
+    server.listenfd = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+    if ( server.listenfd < 0 ) return false;
+
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+    addr.sin_port = 0;
+    if ( bind( server.listenfd, (struct sockaddr *)&addr, sizeof(addr) ) != 0 ) return false;
+    if ( listen( server.listenfd, 4 ) != 0 ) return false;
+
+    socklen_t len = sizeof(addr);
+    if ( getsockname( server.listenfd, (struct sockaddr *)&addr, &len ) != 0 ) return false;
+    server.portno = ntohs( addr.sin_port );
+
+    server.stopping = false;
+    server.nconnections = 0;
+    server.nreplies = 0;
+    server.badheader = false;
+    server.thread = std::thread( serverLoop, &server );
+    return true;
+}
+
+static void localizationDone( void *context, int request_id, bool success, const LocalizationReply *reply )
+{
+    Callbacks *callbacks = (Callbacks *)context;
+
+    Result result;
+    result.id = request_id;
+    result.success = success;
+    result.frame = ( success ) ? reply->ninliers : -1;
+    result.down = ( success ) ? reply->rms : 0;
+
+    std::lock_guard<std::mutex> lock( callbacks->mutex );
+    callbacks->results.push_back( result );
+    callbacks->cond.notify_all();
+}
+
+int main()
+{
+    FakeServer server;
+    if ( !startServer( server ) )
+    {
+        fprintf( stderr, "error: could not start the server\n" );
+        exit(1);
+    }
+
+    Callbacks callbacks;
+    AsyncLocalizationClient client( 1, 0, 2, 1, 3 );
+    if ( !client.start( "127.0.0.1", server.portno, localizationDone, &callbacks ) )
+    {
+        fprintf( stderr, "error: could not start the client\n" );
+        exit(1);
+    }
+
+    // send frames faster than the server replies, so that unsent frames are dropped
+    std::vector<int> ids;
+    for ( int i = 0; i < kNumFrames; i++ )
+    {
+        std::vector<unsigned char> bytes( 256, 0 );
+        memcpy( &bytes[0], &i, sizeof(int) );
+        double down[3] = { 0, 1, (double)i };
+        ids.push_back( client.sendImage( (int)bytes.size(), &bytes[0], NULL, down ) );
+        std::this_thread::sleep_for( std::chrono::milliseconds( kFrameIntervalMs ) );
+    }
+
+    {
+        std::unique_lock<std::mutex> lock( callbacks.mutex );
+        callbacks.cond.wait_for( lock, std::chrono::seconds( 10 ), [&callbacks]{ return (int)callbacks.results.size() >= kNumFrames; } );
+    }
+
+    client.stop();
+
+    server.stopping = true;
+    server.thread.join();
+    close( server.listenfd );
+
+    bool good = true;
+    if ( server.badheader )
+    {
+        std::cout << "server received the wrong protocol version\n";
+        good = false;
+    }
+    if ( (int)callbacks.results.size() != kNumFrames )
+    {
+        std::cout << "expected " << kNumFrames << " callbacks but got " << callbacks.results.size() << "\n";
+        good = false;
+    }
+
+    int nsuccess = 0;
+    int nfailed = 0;
+    for ( size_t i = 0; i < callbacks.results.size(); i++ )
+    {
+        const Result &result = callbacks.results[i];
+        if ( i >= ids.size() || result.id != ids[i] )
+        {
+            std::cout << "callback " << i << " has request id " << result.id << ", out of order\n";
+            good = false;
+            break;
+        }
+        if ( !result.success )
+        {
+            nfailed++;
+            continue;
+        }
+        nsuccess++;
+        if ( result.frame != (int)i || result.down != (double)i )
+        {
+            std::cout << "reply for request " << result.id << " belongs to frame " << result.frame << "\n";
+            good = false;
+        }
+    }
+
+    std::cout << nsuccess << " replies, " << nfailed << " dropped or failed, " << server.nconnections << " connections\n";
+
+    if ( nsuccess == 0 || nfailed == 0 )
+    {
+        std::cout << "expected both replies and dropped frames\n";
+        good = false;
+    }
+    if ( server.nconnections < 2 )
+    {
+        std::cout << "client did not reconnect after the connection was lost\n";
+        good = false;
+    }
+
+    std::cout << "async client " << ( good ? "passed" : "FAILED" ) << "\n";
+
+    return ( good ) ? 0 : 1;
+}
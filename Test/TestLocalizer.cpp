@@ -75,6 +75,65 @@ void loadGPS( const std::string &path, std::vector<Eigen::Vector2d> &gps_locatio
     fclose(f);
 }
 
+// extracts the SIFT features of a camera's image, named uniquely within the camera
+void extractFeatures( Camera *camera, std::vector<Feature*> &features )
+{
+    camera->image = cv::imread( camera->path, cv::IMREAD_GRAYSCALE );
+    camera->features.clear();
+    
+    std::vector<Feature*> myfeatures;
+    extractSIFT( camera->image, myfeatures );
+    for ( int i = 0; i < myfeatures.size(); i++ )
+    {
+        char name[256];
+        sprintf( name, "feature%d", i );
+        myfeatures[i]->name = name;
+        myfeatures[i]->camera = camera;
+        camera->features[name] = myfeatures[i];
+    }
+    features.insert( features.end(), myfeatures.begin(), myfeatures.end() );
+}
+
+// localizes every step-th rig of the query, such as the faces extracted from spherical images, from all of its faces at once
+void localizeRigs( NNLocalizer *localizer, std::vector<Node*> &rigs, int step, Node *queryroot, Reconstruction &query )
+{
+    int goodCount = 0;
+    int attemptedCount = 0;
+    for ( size_t i = 0; i < rigs.size(); i += step )
+    {
+        Node *rignode = rigs[i];
+        
+        std::vector<Feature*> features;
+        ElementList::iterator it;
+        for ( it = rignode->children.begin(); it != rignode->children.end(); it++ )
+        {
+            Node *child = (Node *)it->second;
+            if ( child->camera != NULL ) extractFeatures( child->camera, features );
+        }
+        
+        bool good = localizer->localizeRig( rignode );
+        if ( good ) goodCount++;
+        attemptedCount++;
+        
+        for ( it = rignode->children.begin(); it != rignode->children.end(); it++ )
+        {
+            Node *child = (Node *)it->second;
+            if ( child->camera == NULL ) continue;
+            child->camera->features.clear();
+            child->camera->image = cv::Mat();
+        }
+        for ( int j = 0; j < features.size(); j++ ) delete features[j];
+        
+        if ( good ) {
+            query.nodes.erase( rignode->name );
+            rignode->parent = queryroot;
+            queryroot->children[ rignode->name ] = rignode;
+        }
+    }
+    
+    std::cout << "localized " << goodCount << " of " << attemptedCount << " rigs\n";
+}
+
 int main( int argc, char **argv )
 {
     if ( argc != 4 && argc != 5 ) {
@@ -108,9 +167,17 @@ int main( int argc, char **argv )
 
     std::cout << "done reading descriptors\n";
 
-    loadImages( pathin, root );
-
-    std::cout << "done reading images\n";
+    // the tracker samples its templates from the patch atlas if there is one, otherwise from the images
+    PatchAtlas atlas;
+    std::stringstream atlaspath;
+    atlaspath << pathin << "/atlas.dat";
+    bool have_atlas = atlas.read( atlaspath.str(), r );
+    if ( have_atlas ) {
+        std::cout << "done reading " << atlas.count() << " patches\n";
+    } else {
+        loadImages( pathin, root );
+        std::cout << "done reading images\n";
+    }
 
     double minY = INFINITY;
     for ( ElementList::iterator it = root->children.begin(); it != root->children.end(); it++ ) {
@@ -145,6 +212,22 @@ int main( int argc, char **argv )
     int width = image.size().width;
     localizer->thresh = 0.006 * width / camera->calibration->focal;
     localizer->tracker->minnumpoints = 100;
+    if ( have_atlas ) localizer->tracker->atlas = &atlas;
+    
+    // nodes grouping several cameras, as written by ExtractImagesSpherical and ExtractImagesCatadioptric, are localized as rigs
+    std::vector<Node*> rigs;
+    for ( it = query.nodes.begin(); it != query.nodes.end(); it++ )
+    {
+        Node *node = (Node *)it->second;
+        if ( node == queryroot || node->camera != NULL || node->children.size() < 2 ) continue;
+        rigs.push_back( node );
+    }
+    if ( !rigs.empty() )
+    {
+        localizeRigs( localizer, rigs, step, queryroot, query );
+        XML::write( query, "localized.xml" );
+        return 0;
+    }
     
     Camera *mycamera = new Camera;
     Node *mynode = new Node;
@@ -155,6 +238,16 @@ int main( int argc, char **argv )
     
     std::vector<Eigen::Vector2d> gps_errors;
     
+    // queries with a device attitude give the direction of gravity, which the two point solver uses on upright maps
+    Eigen::Matrix3d mymat;
+    mymat <<
+    0, -1, 0,
+    -1, 0, 0,
+    0, 0,-1;
+    Sophus::SO3d gyroconversion(mymat);
+    bool upright = ( r.upright || r.utmZone != 0 );
+    bool checked_gravity = false;
+    
     int count = 0;
     int goodCount = 0;
     int attemptedCount = 0;
@@ -198,7 +291,33 @@ int main( int argc, char **argv )
             mycamera->features[name] = features[i];
         }
         
+        bool have_gravity = ( upright && querycamera->attitude.log().norm() > 0 );
+        if ( have_gravity ) localizer->gravity = attitudeToDown( querycamera->attitude, gyroconversion ).normalized();
+        
+        // check the two point solver against the three point solver on the first query with gravity
+        bool check_gravity = ( have_gravity && !checked_gravity );
+        Sophus::SE3d three_point_pose;
+        if ( check_gravity )
+        {
+            localizer->has_gravity = false;
+            check_gravity = localizer->localize( mycamera );
+            three_point_pose = mynode->pose;
+        }
+        
+        localizer->has_gravity = have_gravity;
         bool good = localizer->localize( mycamera );
+        
+        if ( check_gravity && good )
+        {
+            Eigen::Vector3d down = three_point_pose.so3() * localizer->map_down;
+            double gravity_error = acos( std::max( -1., std::min( 1., down.dot( localizer->gravity ) ) ) ) * 180. / M_PI;
+            double rotation_diff = ( mynode->pose.so3() * three_point_pose.so3().inverse() ).log().norm() * 180. / M_PI;
+            Eigen::Vector3d center2 = -( mynode->pose.so3().inverse() * mynode->pose.translation() );
+            Eigen::Vector3d center3 = -( three_point_pose.so3().inverse() * three_point_pose.translation() );
+            std::cout << "attitude gravity is " << gravity_error << " degrees from the three point pose's; two point pose differs by "
+                      << rotation_diff << " degrees and " << ( center2 - center3 ).norm() << " in position\n";
+            checked_gravity = true;
+        }
                 
         if ( good ) goodCount++;
         attemptedCount++;
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: TestNCC.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/ncc.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace vrlt;
+
+// checks that every NCC kernel the CPU supports gives exactly the results of the scalar kernel, and times them
+
+struct Results
+{
+    std::vector<unsigned int> sum, sumSq, dotProduct;
+    std::vector<unsigned int> sumStrided, sumSqStrided, dotProductStrided;
+    std::vector<unsigned int> windowSum, windowSumSq, windowDotProduct;
+};
+
+static const int kNumPatches = 10000;
+static const int kRowStep = 37;
+
+static void run( const std::vector<unsigned char> &image, const std::vector<unsigned char> &patches, Results &results )
+{
+    unsigned char *imageptr = (unsigned char *)&image[0];
+    unsigned char *patchptr = (unsigned char *)&patches[0];
+
+    results = Results();
+    for ( int i = 0; i < kNumPatches; i++ )
+    {
+        unsigned char *x = patchptr + 64*i;
+        unsigned char *y = patchptr + 64*( ( i + 1 ) % kNumPatches );
+
+        // unaligned window in an image with an odd row step
+        unsigned char *window = imageptr + ( i % 29 ) * kRowStep + ( i % 23 );
+
+        results.sum.push_back( computeSum( x ) );
+        results.sumSq.push_back( computeSumSq( x ) );
+        results.dotProduct.push_back( computeDotProduct( x, y ) );
+        results.sumStrided.push_back( computeSum( window, kRowStep ) );
+        results.sumSqStrided.push_back( computeSumSq( window, kRowStep ) );
+        results.dotProductStrided.push_back( computeDotProduct( window, kRowStep, y ) );
+        
+        // all windows of a search region at once
+        if ( i % 10 == 0 )
+        {
+            unsigned int sums[64], sumsqs[64], dots[64];
+            computeWindowStatistics( window, kRowStep, y, sums, sumsqs, dots );
+            results.windowSum.insert( results.windowSum.end(), sums, sums+64 );
+            results.windowSumSq.insert( results.windowSumSq.end(), sumsqs, sumsqs+64 );
+            results.windowDotProduct.insert( results.windowDotProduct.end(), dots, dots+64 );
+        }
+    }
+}
+
+// the whole-window statistics must equal those of the 64 windows computed one by one
+static bool checkWindows( const std::vector<unsigned char> &image, const std::vector<unsigned char> &patches )
+{
+    unsigned char *imageptr = (unsigned char *)&image[0];
+    unsigned char *patchptr = (unsigned char *)&patches[0];
+    
+    for ( int i = 0; i < kNumPatches; i += 10 )
+    {
+        unsigned char *y = patchptr + 64*( ( i + 1 ) % kNumPatches );
+        unsigned char *window = imageptr + ( i % 29 ) * kRowStep + ( i % 23 );
+        
+        unsigned int sums[64], sumsqs[64], dots[64];
+        computeWindowStatistics( window, kRowStep, y, sums, sumsqs, dots );
+        for ( int dy = 0; dy < 8; dy++ )
+        {
+            for ( int dx = 0; dx < 8; dx++ )
+            {
+                unsigned char *ptr = window + dy*kRowStep + dx;
+                if ( sums[8*dy+dx] != computeSum( ptr, kRowStep ) ) return false;
+                if ( sumsqs[8*dy+dx] != computeSumSq( ptr, kRowStep ) ) return false;
+                if ( dots[8*dy+dx] != computeDotProduct( ptr, kRowStep, y ) ) return false;
+            }
+        }
+    }
+    return true;
+}
+
+static double timeWindows( const std::vector<unsigned char> &image, const std::vector<unsigned char> &patches )
+{
+    unsigned char *imageptr = (unsigned char *)&image[0];
+    unsigned char *patchptr = (unsigned char *)&patches[0];
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int total = 0;
+    for ( int i = 0; i < kNumPatches; i++ )
+    {
+        unsigned char *y = patchptr + 64*i;
+        unsigned char *window = imageptr + ( i % 29 ) * kRowStep + ( i % 23 );
+        unsigned int sums[64], sumsqs[64], dots[64];
+        computeWindowStatistics( window, kRowStep, y, sums, sumsqs, dots );
+        total += sums[i%64] + sumsqs[i%64] + dots[i%64];
+    }
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    
+    if ( total == 1 ) std::cout << "";
+    
+    return seconds / kNumPatches;
+}
+
+static double time( const std::vector<unsigned char> &image, const std::vector<unsigned char> &patches )
+{
+    unsigned char *imageptr = (unsigned char *)&image[0];
+    unsigned char *patchptr = (unsigned char *)&patches[0];
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    unsigned int total = 0;
+    for ( int rep = 0; rep < 20; rep++ )
+    {
+        for ( int i = 0; i < kNumPatches; i++ )
+        {
+            unsigned char *y = patchptr + 64*i;
+            unsigned char *window = imageptr + ( i % 29 ) * kRowStep + ( i % 23 );
+            total += computeSum( window, kRowStep ) + computeSumSq( window, kRowStep ) + computeDotProduct( window, kRowStep, y );
+        }
+    }
+    double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    // keep the loop from being optimized away
+    if ( total == 1 ) std::cout << "";
+
+    return seconds / ( 20. * kNumPatches );
+}
+
+int main()
+{
+    srand( 1 );
+
+    std::vector<unsigned char> patches( 64 * kNumPatches );
+    for ( size_t i = 0; i < patches.size(); i++ ) patches[i] = rand() % 256;
+
+    // include saturated patches, which give the largest sums
+    for ( int i = 0; i < 64; i++ ) patches[i] = 255;
+
+    std::vector<unsigned char> image( kRowStep * 48 );
+    for ( size_t i = 0; i < image.size(); i++ ) image[i] = rand() % 256;
+
+    const char *names[] = { "scalar", "SSE4.1", "AVX2", "NEON" };
+    NCCKernel best = getNCCKernel();
+
+    if ( !setNCCKernel( NCCKernelScalar ) )
+    {
+        // NEON builds have no scalar path to compare against
+        std::cout << "only the " << names[best] << " kernel is available\n";
+        return 0;
+    }
+    Results reference;
+    run( image, patches, reference );
+    std::cout << "scalar: " << time( image, patches ) * 1e9 << " ns per window, " << timeWindows( image, patches ) * 1e9 << " ns per search region\n";
+
+    bool good = checkWindows( image, patches );
+    if ( !good ) std::cout << "scalar: search region statistics DIFFER FROM single windows\n";
+    NCCKernel kernels[] = { NCCKernelSSE41, NCCKernelAVX2 };
+    for ( int k = 0; k < 2; k++ )
+    {
+        if ( !setNCCKernel( kernels[k] ) )
+        {
+            std::cout << names[kernels[k]] << ": not supported by this CPU\n";
+            continue;
+        }
+
+        Results results;
+        run( image, patches, results );
+        bool same = ( results.sum == reference.sum && results.sumSq == reference.sumSq && results.dotProduct == reference.dotProduct &&
+                      results.sumStrided == reference.sumStrided && results.sumSqStrided == reference.sumSqStrided &&
+                      results.dotProductStrided == reference.dotProductStrided &&
+                      results.windowSum == reference.windowSum && results.windowSumSq == reference.windowSumSq &&
+                      results.windowDotProduct == reference.windowDotProduct && checkWindows( image, patches ) );
+        std::cout << names[kernels[k]] << ": " << ( same ? "matches" : "DIFFERS FROM" ) << " scalar; " << time( image, patches ) * 1e9 << " ns per window, "
+                  << timeWindows( image, patches ) * 1e9 << " ns per search region\n";
+        if ( !same ) good = false;
+    }
+
+    setNCCKernel( best );
+
+    return ( good ) ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: TestRigLocalizer.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <MultiView/multiview.h>
+#include <Localizer/nnlocalizer.h>
+#include <FeatureMatcher/nn.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace vrlt;
+
+// localizes a synthetic cube-map rig, as written by ExtractImagesSpherical, and checks that the known rig pose is recovered
+
+static const int kNumPoints = 1500;
+static const int kFaceSize = 600;
+static const double kFocal = 300;           // 90 degree faces, so the six faces cover every direction
+static const double kOutlierRatio = 0.3;    // query features given the descriptor of the wrong point
+static const double kNoise = 0.5;           // feature location noise in pixels
+
+/** Exact nearest neighbors by linear search, so that the result does not depend on the approximate index. */
+class ExactNN : public NN
+{
+public:
+    ExactNN() : N( 0 ), data( NULL ) { }
+
+    void setData( int _N, unsigned char *_data ) { N = _N; data = _data; }
+
+    void findnn( int num_queries, unsigned char *queries, int *neighbors, unsigned int *distances_sq )
+    {
+        findknn( num_queries, queries, 1, neighbors, distances_sq );
+    }
+
+    void findknn( int num_queries, unsigned char *queries, int k, int *neighbors, unsigned int *distances_sq )
+    {
+        for ( int m = 0; m < num_queries; m++ )
+        {
+            int *best = neighbors + m*k;
+            unsigned int *bestdist = distances_sq + m*k;
+            for ( int j = 0; j < k; j++ ) { best[j] = -1; bestdist[j] = UINT_MAX; }
+
+            for ( int n = 0; n < N; n++ )
+            {
+                unsigned int distsq = 0;
+                for ( int d = 0; d < 128; d++ )
+                {
+                    int diff = (int)queries[128*m+d] - (int)data[128*n+d];
+                    distsq += diff * diff;
+                }
+                for ( int j = 0; j < k; j++ )
+                {
+                    if ( distsq >= bestdist[j] ) continue;
+                    for ( int l = k-1; l > j; l-- ) { best[l] = best[l-1]; bestdist[l] = bestdist[l-1]; }
+                    best[j] = n;
+                    bestdist[j] = distsq;
+                    break;
+                }
+            }
+        }
+    }
+
+protected:
+    int N;
+    unsigned char *data;
+};
+
+static double uniform( double a, double b )
+{
+    return a + ( b - a ) * ( rand() / (double)RAND_MAX );
+}
+
+static Calibration * makeCalibration( const char *name )
+{
+    Calibration *calibration = new Calibration;
+    calibration->name = name;
+    calibration->focal = kFocal;
+    calibration->center = Eigen::Vector2d( kFaceSize * 0.5 - 0.5, kFaceSize * 0.5 - 0.5 );
+    calibration->makeK();
+    calibration->makeKinverse();
+    return calibration;
+}
+
+int main()
+{
+    srand( 1 );
+
+    // map: points around the rig, each seen by one map camera with a random descriptor
+    Reconstruction r;
+    Node *root = new Node;
+    root->name = "root";
+    r.nodes["root"] = root;
+
+    Calibration *mapcalibration = makeCalibration( "map" );
+    r.calibrations["map"] = mapcalibration;
+    Camera *mapcamera = new Camera;
+    mapcamera->name = "mapcamera";
+    mapcamera->calibration = mapcalibration;
+    Node *mapnode = new Node;
+    mapnode->name = "mapnode";
+    mapnode->camera = mapcamera;
+    mapnode->parent = root;
+    mapcamera->node = mapnode;
+    root->children["mapnode"] = mapnode;
+    r.cameras["mapcamera"] = mapcamera;
+
+    Eigen::Vector3d center( 1, 0.5, 2 );
+    std::vector<Point*> points;
+    for ( int i = 0; i < kNumPoints; i++ )
+    {
+        char name[256];
+        sprintf( name, "point%05d", i );
+
+        Eigen::Vector3d direction( uniform( -1, 1 ), uniform( -1, 1 ), uniform( -1, 1 ) );
+        Eigen::Vector3d X = center + uniform( 5, 20 ) * direction.normalized();
+
+        Point *point = new Point;
+        point->name = name;
+        point->position = Eigen::Vector4d( X[0], X[1], X[2], 1 );
+        point->normal = -direction.normalized();
+        Track *track = new Track;
+        track->name = name;
+        track->point = point;
+        point->track = track;
+
+        Feature *feature = new Feature;
+        sprintf( name, "feature%05d", i );
+        feature->name = name;
+        feature->camera = mapcamera;
+        feature->track = track;
+        feature->descriptor = new unsigned char[128];
+        for ( int d = 0; d < 128; d++ ) feature->descriptor[d] = rand() % 256;
+        track->features[name] = feature;
+        mapcamera->features[name] = feature;
+
+        root->points[point->name] = point;
+        r.tracks[track->name] = track;
+        r.features[feature->name] = feature;
+        points.push_back( point );
+    }
+
+    // query: six cube faces about a common center
+    Sophus::SO3d rotation = Sophus::SO3d::exp( Eigen::Vector3d( 0.3, -1.2, 0.2 ) );
+    Sophus::SE3d truepose( rotation, -( rotation * center ) );
+
+    Node *rignode = new Node;
+    rignode->name = "rig";
+    Calibration *facecalibration = makeCalibration( "face" );
+    Sophus::SO3d faceRotations[6] = {
+        Sophus::SO3d(),
+        Sophus::SO3d::exp( Eigen::Vector3d( 0, M_PI/2, 0 ) ),
+        Sophus::SO3d::exp( Eigen::Vector3d( 0, M_PI, 0 ) ),
+        Sophus::SO3d::exp( Eigen::Vector3d( 0, -M_PI/2, 0 ) ),
+        Sophus::SO3d::exp( Eigen::Vector3d( M_PI/2, 0, 0 ) ),
+        Sophus::SO3d::exp( Eigen::Vector3d( -M_PI/2, 0, 0 ) )
+    };
+    std::vector<Camera*> faces;
+    for ( int f = 0; f < 6; f++ )
+    {
+        char name[256];
+        Camera *camera = new Camera;
+        sprintf( name, "face%d", f );
+        camera->name = name;
+        camera->calibration = facecalibration;
+        Node *node = new Node;
+        sprintf( name, "face%d.node", f );
+        node->name = name;
+        node->pose.so3() = faceRotations[f];
+        node->camera = camera;
+        node->parent = rignode;
+        camera->node = node;
+        rignode->children[node->name] = node;
+        faces.push_back( camera );
+    }
+
+    int nqueryfeatures = 0;
+    for ( int i = 0; i < kNumPoints; i++ )
+    {
+        Eigen::Vector3d X = truepose * points[i]->position.head(3);
+
+        for ( int f = 0; f < 6; f++ )
+        {
+            Eigen::Vector3d PX = faceRotations[f] * X;
+            if ( PX[2] <= 0 ) continue;
+            Eigen::Vector2d location = facecalibration->project( project( PX ) );
+            if ( location[0] < 0 || location[0] >= kFaceSize || location[1] < 0 || location[1] >= kFaceSize ) continue;
+
+            // outliers carry the descriptor of another point
+            int source = i;
+            if ( uniform( 0, 1 ) < kOutlierRatio ) source = ( i + 1 + rand() % ( kNumPoints - 1 ) ) % kNumPoints;
+            Feature *mapfeature = (Feature*)points[source]->track->features.begin()->second;
+
+            char name[256];
+            sprintf( name, "feature%05d", i );
+            Feature *feature = new Feature;
+            feature->name = name;
+            feature->camera = faces[f];
+            feature->location = location + Eigen::Vector2d( uniform( -kNoise, kNoise ), uniform( -kNoise, kNoise ) );
+            feature->scale = 1;
+            feature->descriptor = new unsigned char[128];
+            for ( int d = 0; d < 128; d++ ) feature->descriptor[d] = std::min( 255, std::max( 0, mapfeature->descriptor[d] + rand() % 7 - 3 ) );
+            faces[f]->features[name] = feature;
+            nqueryfeatures++;
+            break;
+        }
+    }
+    std::cout << nqueryfeatures << " query features on " << faces.size() << " faces\n";
+
+    NNLocalizer *localizer = new NNLocalizer( root, new ExactNN );
+    localizer->thresh = 2. / kFocal;
+
+    bool good = localizer->localizeRig( rignode );
+    if ( !good )
+    {
+        std::cout << "rig localization FAILED\n";
+        return 1;
+    }
+
+    Sophus::SE3d diff = rignode->pose * truepose.inverse();
+    double rotationError = diff.so3().log().norm() * 180. / M_PI;
+    Eigen::Vector3d estimatedCenter = -( rignode->pose.so3().inverse() * rignode->pose.translation() );
+    double centerError = ( estimatedCenter - center ).norm();
+
+    std::cout << localizer->ninliers << " inliers, rms " << localizer->rms << " px\n";
+    std::cout << "rotation error: " << rotationError << " degrees, center error: " << centerError << " m\n";
+
+    good = ( rotationError < 0.1 && centerError < 0.05 && localizer->ninliers > nqueryfeatures / 2 );
+    std::cout << "rig pose " << ( good ? "recovered" : "NOT RECOVERED" ) << "\n";
+
+    return ( good ) ? 0 : 1;
+}
@@ -11,6 +11,8 @@
 #include <MultiView/multiview.h>
 #include <MultiView/multiview_io_xml.h>
 #include <PatchTracker/tracker.h>
+#include <PatchTracker/motionmodel.h>
+#include <PatchTracker/localmapper.h>
 
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
@@ -137,16 +139,22 @@ int main( int argc, char **argv )
     tracker.minnumpoints = 100;
     tracker.minratio = minratio;
     tracker.do_pose_update = false;
+    tracker.profiler.enabled = true;
     
-    // load images
+    // sample templates from the patch atlas if there is one, otherwise load images as the tracker needs them
+    PatchAtlas atlas;
+    ImageProvider images( pathin, (size_t)1 << 30 );
+    std::stringstream atlaspath;
+    atlaspath << pathin << "/atlas.dat";
     ElementList::iterator it;
-    for ( it = r.cameras.begin(); it != r.cameras.end(); it++ )
+    if ( atlas.read( atlaspath.str(), r ) )
     {
-        Camera *camera = (Camera *)it->second;
-        std::stringstream path;
-        path << pathin << "/" << camera->path;
-        camera->image = cv::imread( path.str(), cv::IMREAD_GRAYSCALE );
-        camera->pyramid = ImagePyramid( camera );
+        std::cout << "read " << atlas.count() << " patches from " << atlaspath.str() << "\n";
+        tracker.atlas = &atlas;
+    }
+    else
+    {
+        tracker.images = &images;
     }
     
     // load query
@@ -175,40 +183,27 @@ int main( int argc, char **argv )
     Sophus::SO3d gyroconversion(mymat);
     
     int count = 0;
-    Sophus::SE3d localizer_pose;
-    Sophus::SO3d localizer_attitude;
-    double prev_timestamp;
-    Sophus::SO3d prev_attitude;
     
     Sophus::SE3d last_pose;
+    
+    // predicts each frame's pose from the last tracked pose and the gyro
+    MotionModel motion;
+    motion.imuToCamera = gyroconversion;
 
     std::vector<Camera*> trackedCameras;
     
     RobustLeastSq robustlsq( root );
     
     int framesSinceLocalized = 0;
+    
+    // builds new keyframes off the tracking thread
+    LocalMapper mapper;
 
     for ( it = query.cameras.begin(); it != query.cameras.end(); it++,count++ )
     {
         Camera *querycamera = (Camera*)it->second;
         Node *querynode = (Node *)querycamera->node;
         
-        // get gyro input
-        Sophus::SO3d queryattitude = gyroconversion * querycamera->attitude * gyroconversion;
-        double querytimestamp = querycamera->timestamp;
-        
-        prev_attitude = queryattitude;
-        prev_timestamp = querytimestamp;
-        
-        Eigen::Vector3d gyroxyz = querycamera->rotationRate;
-        Eigen::Vector3d gyrox, gyroy, gyroz;
-        gyrox << gyroxyz[0], 0, 0;
-        gyroy << 0, gyroxyz[1], 0;
-        gyroz << 0, 0, gyroxyz[2];
-        
-        Sophus::SO3d gyro( Sophus::SO3d::exp( gyroz ) * Sophus::SO3d::exp( gyroy ) * Sophus::SO3d::exp( gyrox ) );
-        gyro = gyroconversion * gyro * gyroconversion;
-        
         // create query node if necessary
         if ( querynode == NULL )
         {
@@ -230,23 +225,37 @@ int main( int argc, char **argv )
         if ( querynode->root() == queryroot && nlost >= nmaxlost ) {
             last_pose = querynode->pose;
             framesSinceLocalized = 0;
+            motion.reset();
         }
         
-        // get predicted pose
-        querynode->pose = last_pose;
+        // get predicted pose, and start the search only as coarse as the prediction error calls for
+        if ( motion.hasPose() )
+        {
+            querynode->pose = motion.predict( querycamera );
+            tracker.firstlevel = motion.firstLevel( querycamera->calibration->focal, tracker.lastlevel, 3 );
+        }
+        else
+        {
+            querynode->pose = last_pose;
+            tracker.firstlevel = 3;
+        }
         
         // load the image
         trackercamera->image = cv::imread( querycamera->path, cv::IMREAD_GRAYSCALE );
         trackercamera->pyramid.resize( trackercamera->image.size() );
         trackercamera->pyramid.copy_from( trackercamera->image );
         
+        // take in the keyframes finished since the last frame
+        mapper.apply( r, tracker );
+        
         // run tracker
         bool good = tracker.track( trackercamera );
         std::cout << "tracked: " << tracker.ntracked << " / " << tracker.nattempted << " (" << tracker.ntracked / (float) tracker.nattempted << ")\n";
 		int ntracked = 0;
 		float newratio = (float)tracker.nnew / (float)tracker.ntracked;
 		if ( good ) {
-            good = robustlsq.run( trackercamera );
+            Profiler::Scope scope( tracker.profiler, "pose update", -1, tracker.ntracked );
+            good = robustlsq.run( trackercamera, tracker.pointStore );
             good = updatePose( root, trackercamera );
             if ( good ) {
                 ElementList::iterator it;
@@ -266,6 +275,7 @@ int main( int argc, char **argv )
             
             trackedCameras.push_back( querycamera );
             last_pose = querycamera->node->pose;
+            motion.update( querycamera, last_pose );
 
 			bool should_add = true;
             
@@ -298,13 +308,9 @@ int main( int argc, char **argv )
             if ( framesSinceLocalized < 30 ) should_add = false;
 	
             // un-comment to disable keyframe sampling
-            should_add = false;
-            if ( should_add ) {
-				Camera *newcamera = NULL;
-                newcamera = addCameraToReconstruction( r, querycamera->calibration,
-														trackercamera->image, querycamera->node->pose );
-                tracker.cameras.push_back( newcamera );
-            }
+            //should_add = false;
+            // the image is read anew for each frame, so the mapper can keep this one
+            if ( should_add ) mapper.submit( querycamera, trackercamera->image, tracker );
             
             framesSinceLocalized++;
         } else {
@@ -363,6 +369,13 @@ int main( int argc, char **argv )
     }
     
     XML::write( query, "tracked.xml" );
+    
+    // per-stage timings of every frame
+    tracker.profiler.writeCSV( "profile.csv" );
+    tracker.profiler.writeTrace( "profile.json" );
+    
+    std::cout << "keyframes: " << mapper.nadded << " added, " << mapper.ndropped << " dropped while busy\n";
+    if ( tracker.images != NULL ) std::cout << "source images: " << images.nhits << " hits, " << images.nprefetched << " prefetched, " << images.nmisses << " misses\n";
 
     return 0;
 }
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2012. The Regents of the University of California. All rights reserved.
+ * Licensed pursuant to the terms and conditions available for viewing at:
+ * http://opensource.org/licenses/BSD-3-Clause
+ *
+ * File: TestWarp.cpp
+ * Author: Jonathan Ventura
+ * Last Modified: 18.10.2026
+ */
+
+#include <PatchTracker/sampler.h>
+
+#include <opencv2/core/eigen.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace vrlt;
+
+// checks that warpPatch gives the templates of cv::warpPerspective, including patches crossing the image border, and times both
+
+static const int kNumPatches = 10000;
+
+static float uniform( float lo, float hi )
+{
+    return lo + ( hi - lo ) * ( rand() / (float)RAND_MAX );
+}
+
+int main()
+{
+    srand( 1 );
+    
+    cv::Mat image( 240, 320, CV_8UC1 );
+    for ( int y = 0; y < image.rows; y++ )
+        for ( int x = 0; x < image.cols; x++ )
+            image.at<unsigned char>( y, x ) = rand() % 256;
+    
+    std::vector<Eigen::Matrix3f> matrices;
+    for ( int i = 0; i < kNumPatches; i++ )
+    {
+        // mild perspective warps, as between nearby views
+        Eigen::Matrix3f warp = Eigen::Matrix3f::Identity();
+        warp(0,0) += uniform( -0.3f, 0.3f );
+        warp(0,1) += uniform( -0.3f, 0.3f );
+        warp(1,0) += uniform( -0.3f, 0.3f );
+        warp(1,1) += uniform( -0.3f, 0.3f );
+        warp(2,0) = uniform( -0.001f, 0.001f );
+        warp(2,1) = uniform( -0.001f, 0.001f );
+        
+        Eigen::Vector2f center( uniform( -10.f, image.cols + 10.f ), uniform( -10.f, image.rows + 10.f ) );
+        float scale = ( i % 3 == 0 ) ? 0.5f : 1.f;
+        matrices.push_back( Sampler::warpMatrix( center, warp, scale, 8 ) );
+    }
+    
+    std::vector<unsigned char> reference( 64 * kNumPatches );
+    std::vector<unsigned char> results( 64 * kNumPatches );
+    
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < kNumPatches; i++ )
+    {
+        cv::Mat cvM( 3, 3, CV_32FC1 );
+        cv::eigen2cv( matrices[i], cvM );
+        cv::Mat templatePatch( cv::Size(8,8), CV_8UC1, &reference[64*i] );
+        cv::warpPerspective( image, templatePatch, cvM, templatePatch.size(), cv::WARP_INVERSE_MAP );
+    }
+    double opencvTime = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    
+    std::vector<PatchWarp> warps( kNumPatches );
+    for ( int i = 0; i < kNumPatches; i++ )
+    {
+        warps[i].image = &image;
+        warps[i].M = matrices[i];
+        warps[i].patch = &results[64*i];
+    }
+    
+    start = std::chrono::steady_clock::now();
+    warpPatches( &warps[0], kNumPatches );
+    double warpTime = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    
+    // OpenCV builds using IPP may round differently, so report exact matches and the largest difference
+    int exact = 0;
+    int maxdiff = 0;
+    for ( size_t i = 0; i < results.size(); i++ )
+    {
+        int diff = abs( (int)results[i] - (int)reference[i] );
+        if ( diff == 0 ) exact++;
+        if ( diff > maxdiff ) maxdiff = diff;
+    }
+    
+    std::cout << "cv::warpPerspective: " << opencvTime / kNumPatches * 1e9 << " ns per patch\n";
+    std::cout << "warpPatches: " << warpTime / kNumPatches * 1e9 << " ns per patch\n";
+    std::cout << exact << " of " << results.size() << " pixels identical, largest difference " << maxdiff << "\n";
+    
+    return ( maxdiff <= 1 ) ? 0 : 1;
+}
@@ -14,7 +14,8 @@
 #include <MultiView/multiview.h>
 #include <PatchTracker/tracker.h>
 #include <PatchTracker/robustlsq.h>
-#include <LocalizerClient/client.h>
+#include <PatchTracker/motionmodel.h>
+#include <LocalizerClient/asyncclient.h>
 
 #include <ImageCache/imagecache.h>
 
@@ -43,14 +44,16 @@
     NSLock *imagecachelock;
     
     vrlt::Tracker *tracker;
+    vrlt::MotionModel *motion;
     vrlt::Reconstruction *r;
     
     BOOL doTrack;
     BOOL tracked;
 
     BOOL needLocalize;
-    vrlt::LocalizationClient *localizer;
+    vrlt::AsyncLocalizationClient *localizer;
     NSLock *localizerlock;
+    NSMutableDictionary *pendingRequests;
     NSMutableArray *localizerResponses;
     NSLock *localizerResponsesLock;
     
@@ -70,7 +73,9 @@
 - (id)initWithPrefix:(NSString*)prefix scale:(int)theScale shift:(int)theShift;
 - (int)numFramesInCache;
 - (void)process;
+- (void)setSensorAttitude:(Sophus::SO3d)attitude rotationRate:(Eigen::Vector3d)rotationRate timestamp:(double)timestamp;
 - (void)requestLocalization:(id)arg;
+- (void)finishRequest:(int)requestId reply:(const vrlt::LocalizationReply *)reply;
 @property (assign) int maxnumpoints;
 @property (assign) BOOL needLocalize;
 @property (nonatomic,retain) VideoHandler *videoHandler;
@@ -86,8 +91,12 @@
     unsigned char *imagedata;
     double *posedata;
     Sophus::SO3d attitude;
+    double down[3];
+    BOOL hasDown;
 }
-- (id)initWithImageData:(const unsigned char *)data attitude:(Sophus::SO3d)att;
+- (id)initWithImageData:(const unsigned char *)data attitude:(Sophus::SO3d)att down:(const double *)_down;
+/** Direction of gravity in the camera frame, or NULL if the device attitude was unknown. */
+- (const double *)down;
 @property (assign) unsigned char *imagedata;
 @property (assign) double *posedata;
 @property (assign) Sophus::SO3d attitude;
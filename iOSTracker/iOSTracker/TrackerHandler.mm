@@ -12,6 +12,8 @@
 using namespace std;
 using namespace vrlt;
 
+static void localizationDone( void *context, int request_id, bool success, const LocalizationReply *reply );
+
 @implementation TrackerHandler
 @synthesize maxnumpoints;
 @synthesize needLocalize;
@@ -126,15 +128,27 @@ static void copyImageData( UIImage *image, Camera *camera )
         tracker->niter = 10;
         tracker->firstlevel = 3;
         tracker->lastlevel = 0;
+        // leave time for the pose update and drawing within a 30 Hz frame
+        tracker->budget.frameTime = 0.02;
         doTrack = YES;
         
         tracker->minnumpoints = minnumpoints;
         tracker->minratio = minratio;
         
+        // predicts each frame's pose from the last tracked pose and the device motion
+        Eigen::Matrix3d mymat;
+        mymat <<
+        0,-1, 0,
+        -1, 0, 0,
+        0, 0,-1;
+        motion = new MotionModel;
+        motion->imuToCamera = Sophus::SO3d( mymat );
+        
         needLocalize = NO;
         localizer = NULL;
         localizerlock = [[NSLock alloc] init];
         
+        pendingRequests = [[NSMutableDictionary alloc] init];
         localizerResponses = [[NSMutableArray alloc] init];
         localizerResponsesLock = [[NSLock alloc] init];
         
@@ -145,14 +159,10 @@ static void copyImageData( UIImage *image, Camera *camera )
 #ifdef USE_LOCALIZER
         scale = theScale;
         shift = theShift;
-        localizer = new LocalizationClient( scale, shift );
-        bool connected;
-        for ( int i = 0; i < 10; i++ ) {
-            connected = localizer->connectToServer( "192.168.0.106", 12345+i );
-            if ( connected ) break;
-        }
-        if ( !connected ) {
-            NSLog( @"could not connect" );
+        // the client connects and reconnects in the background, so tracking never waits on the network
+        localizer = new AsyncLocalizationClient( scale, shift, 1, 1, LOCALIZER_PROTOCOL_VERSION );
+        if ( !localizer->start( "192.168.0.106", 12345, localizationDone, self ) ) {
+            NSLog( @"could not start localization client" );
             exit(0);
         }
 #endif
@@ -174,6 +184,7 @@ static void copyImageData( UIImage *image, Camera *camera )
 {
     delete imagecache;
     delete tracker;
+    delete motion;
 
     delete calibration;
     delete camera;
@@ -181,10 +192,14 @@ static void copyImageData( UIImage *image, Camera *camera )
     
     delete r;
     
+    // stop the client first, so no callback arrives after the requests are gone
     delete localizer;
 
     [imagecachelock release];
     [localizerlock release];
+    [pendingRequests release];
+    [localizerResponses release];
+    [localizerResponsesLock release];
     
     free( data2 );
     free( data4 );
@@ -201,6 +216,13 @@ static void copyImageData( UIImage *image, Camera *camera )
     camera->pyramid.remake();
 }
 
+- (void)setSensorAttitude:(Sophus::SO3d)attitude rotationRate:(Eigen::Vector3d)rotationRate timestamp:(double)timestamp
+{
+    camera->attitude = attitude;
+    camera->rotationRate = rotationRate;
+    camera->timestamp = timestamp;
+}
+
 - (int)numFramesInCache
 {
     return imagecache->cache.size();
@@ -229,6 +251,7 @@ static void copyImageData( UIImage *image, Camera *camera )
         if ( ntimeslost > 30 ) {
             camera->node->pose.so3() = (videoHandler.currentAttitude * response.attitude.inverse()) * pose.so3();
             camera->node->pose.translation() = (videoHandler.currentAttitude * response.attitude.inverse()) * pose.translation();
+            motion->reset();
         }
         
         [response release];
@@ -246,8 +269,20 @@ static void copyImageData( UIImage *image, Camera *camera )
     [localizerResponses removeAllObjects];
     [localizerResponsesLock unlock];
     
+    // predict the pose, and start the search only as coarse as the prediction error calls for
+    if ( motion->hasPose() ) {
+        node->pose = motion->predict( camera );
+        tracker->firstlevel = motion->firstLevel( calibration->focal, tracker->lastlevel, 3 );
+    } else {
+        tracker->firstlevel = 3;
+    }
+    
     tracked = tracker->track( camera );
-    if ( tracked ) robustlsq->run( camera );
+    if ( tracked ) {
+        Profiler::Scope scope( tracker->profiler, "pose update", -1, tracker->ntracked );
+        robustlsq->run( camera, tracker->pointStore );
+        motion->update( camera, camera->node->pose );
+    }
     
     NSLog( @"tracked %d/%d points", tracker->ntracked, tracker->nattempted );
     
@@ -314,6 +349,8 @@ static void copyImageData( UIImage *image, Camera *camera )
         
         if ( ntimeslost >= 30 ) {
             self.needLocalize = YES;
+            // the last tracked pose is too old to extrapolate from
+            motion->reset();
         }
     }
     
@@ -386,34 +423,59 @@ static NSData * getJPEGData( const cv::Mat &image, float quality )
     unsigned char *data = request.imagedata;
     
     NSData *jpegData = getJPEGData( cv::Mat( cv::Size( w, h ), CV_8UC1, data ), 0.2 );
-    localizer->sendImage( jpegData.length, (unsigned char *) jpegData.bytes );
-    [jpegData release];
     
-    BOOL success = FALSE;
-    for ( int i = 0; i < 6; i++ ) if ( request.posedata[i] != 0 ) success = TRUE;
-    if ( success )
-    {
-        [localizerResponsesLock lock];
-        [localizerResponses addObject:request];
-        [localizerResponsesLock unlock];
-    } else {
-        [request release];
-    }
+    // the request waits in pendingRequests for its reply; holding the lock keeps the callback from running before it is there
+    [localizerResponsesLock lock];
+    // the gravity direction lets the server use the two point solver on upright maps
+    int requestId = localizer->sendImage( jpegData.length, (unsigned char *) jpegData.bytes, NULL, [request down] );
+    [pendingRequests setObject:request forKey:[NSNumber numberWithInt:requestId]];
+    [localizerResponsesLock unlock];
+    [request release];
+    [jpegData release];
     
     [localizerlock unlock];
     
     [pool release];
 }
 
+- (void)finishRequest:(int)requestId reply:(const vrlt::LocalizationReply *)reply
+{
+    NSNumber *key = [NSNumber numberWithInt:requestId];
+    
+    [localizerResponsesLock lock];
+    LocalizationRequest *request = [[pendingRequests objectForKey:key] retain];
+    [pendingRequests removeObjectForKey:key];
+    if ( request != nil )
+    {
+        if ( reply != NULL && reply->status != ReplyFailed )
+        {
+            memcpy( request.posedata, reply->pose, 6*sizeof(double) );
+            [localizerResponses addObject:request];
+        } else {
+            [request release];
+        }
+    }
+    [localizerResponsesLock unlock];
+}
+
 @end
 
+// called on the localization client's thread, in request order
+static void localizationDone( void *context, int request_id, bool success, const LocalizationReply *reply )
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    TrackerHandler *handler = (TrackerHandler *)context;
+    [handler finishRequest:request_id reply:( success ) ? reply : NULL];
+    [pool release];
+}
+
 
 @implementation LocalizationRequest
 @synthesize attitude;
 @synthesize imagedata;
 @synthesize posedata;
 
-- (id)initWithImageData:(const unsigned char *)data attitude:(Sophus::SO3d)att
+- (id)initWithImageData:(const unsigned char *)data attitude:(Sophus::SO3d)att down:(const double *)_down
 {
     if ( ( self = [super init] ) )
     {
@@ -422,12 +484,19 @@ static NSData * getJPEGData( const cv::Mat &image, float quality )
         posedata = (double *)malloc( 6*sizeof(double) );
         memcpy( imagedata, data, 1280*720 );
         attitude = att;
+        hasDown = ( _down != NULL );
+        if ( hasDown ) memcpy( down, _down, 3*sizeof(double) );
 #endif
     }
     
     return self;
 }
 
+- (const double *)down
+{
+    return ( hasDown ) ? down : NULL;
+}
+
 - (void)dealloc
 {
 #ifdef USE_LOCALIZER
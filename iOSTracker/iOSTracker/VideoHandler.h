@@ -55,6 +55,8 @@
     
     Sophus::SO3d lastAttitude;
     Sophus::SO3d currentAttitude;
+    Eigen::Vector3d currentDown;    // gravity in the camera frame, from the device attitude
+    BOOL haveAttitude;
 }
 - (void)processMotion:(CMDeviceMotion*)motion;
 - (void)localize;
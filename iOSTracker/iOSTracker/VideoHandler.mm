@@ -204,6 +204,11 @@ using namespace vrlt;
     Sophus::SO3d R( Rmat );
     
     currentAttitude = gyroconversion * R * gyroconversion;
+    currentDown = attitudeToDown( R, gyroconversion );
+    haveAttitude = YES;
+    
+    // the motion model takes the device attitude and rate, in device axes
+    [trackerHandler setSensorAttitude:R rotationRate:makeVector( motion.rotationRate.x, motion.rotationRate.y, motion.rotationRate.z ) timestamp:motion.timestamp];
     
 
 
@@ -257,7 +262,7 @@ using namespace vrlt;
     {
         trackerHandler.needLocalize = NO;
         
-        LocalizationRequest *request = [[LocalizationRequest alloc] initWithImageData:grayData attitude:currentAttitude];
+        LocalizationRequest *request = [[LocalizationRequest alloc] initWithImageData:grayData attitude:currentAttitude down:( haveAttitude ) ? currentDown.data() : NULL];
         [NSThread detachNewThreadSelector:@selector(requestLocalization:) toTarget:trackerHandler withObject:request];
     }
     